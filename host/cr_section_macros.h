@@ -0,0 +1,17 @@
+/*
+ * cr_section_macros.h
+ *
+ * Stand-in for the LPCXpresso header of the same name so that the firmware
+ * sources compile in the host build. Memory placement has no meaning on
+ * the host, so the section macros expand to nothing.
+ */
+
+#ifndef CR_SECTION_MACROS_H_
+#define CR_SECTION_MACROS_H_
+
+#define __DATA(bank)
+#define __BSS(bank)
+#define __RODATA(bank)
+#define __NOINIT(bank)
+
+#endif /* CR_SECTION_MACROS_H_ */
@@ -0,0 +1,409 @@
+/*
+ * eeprom_client.c
+ *
+ * Host side client for the LPC8xx_Flash_EEPROM console. Reads and writes
+ * the 'EEPROM' bank using the binary framed protocol (see binproto.h),
+ * benchmarks it against the text W command, measures round-trip
+ * latency of the text commands and checks the erase budget under a storm
+ * of writes.
+ *
+ * Build (Linux):
+ *   gcc -O2 -Isrc -o eeprom_client host/eeprom_client.c src/crc.c
+ *
+ * Usage:
+ *   eeprom_client <tty> read
+ *   eeprom_client <tty> write <addr> <hexbytes>
+ *   eeprom_client <tty> bench
+ *   eeprom_client <tty> latency [count]
+ *   eeprom_client <tty> storm [writes/s] [seconds]
+ *
+ * <tty> is the serial port of the device (or the pty of the host build).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+
+#include "crc.h"
+#include "binproto.h"
+
+#define TIMEOUT_MS 5000
+
+static int fd;
+
+static double now_s(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int open_tty(const char *path) {
+	struct termios t;
+	int f = open(path, O_RDWR | O_NOCTTY);
+	if (f < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (tcgetattr(f, &t) == 0) {
+		cfmakeraw(&t);
+		cfsetispeed(&t, B9600);
+		cfsetospeed(&t, B9600);
+		tcsetattr(f, TCSANOW, &t);
+	}
+	return f;
+}
+
+static void send_all(const uint8_t *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Read one byte, or return -1 on timeout
+ */
+static int recv_byte(void) {
+	struct pollfd p = { fd, POLLIN, 0 };
+	uint8_t c;
+	if (poll(&p, 1, TIMEOUT_MS) <= 0 || read(fd, &c, 1) != 1) {
+		return -1;
+	}
+	return c;
+}
+
+/*
+ * Discard input until string s has been received
+ */
+static int wait_for(const char *s) {
+	size_t matched = 0;
+	int c;
+	while (s[matched] != 0) {
+		if ((c = recv_byte()) < 0) return -1;
+		matched = (c == s[matched]) ? matched + 1 : (c == s[0]);
+	}
+	return 0;
+}
+
+static void slip_put(uint8_t *out, size_t *n, uint8_t c) {
+	if (c == BINPROTO_END) {
+		out[(*n)++] = BINPROTO_ESC;
+		out[(*n)++] = BINPROTO_ESC_END;
+	} else if (c == BINPROTO_ESC) {
+		out[(*n)++] = BINPROTO_ESC;
+		out[(*n)++] = BINPROTO_ESC_ESC;
+	} else {
+		out[(*n)++] = c;
+	}
+}
+
+/*
+ * Send a request frame and wait for its response.
+ *
+ * @return Response status, or -1 on timeout / bad response. For reads,
+ * data is filled with the bytes returned.
+ */
+static int transact(uint8_t cmd, uint8_t addr, uint8_t len, uint8_t *data) {
+	uint8_t f[BINPROTO_MAX_FRAME], out[2 * BINPROTO_MAX_FRAME + 2];
+	size_t i, n = 0, flen = 0;
+	uint16_t crc;
+	int c;
+
+	f[flen++] = cmd;
+	f[flen++] = addr;
+	f[flen++] = len;
+	if (cmd != BINPROTO_CMD_READ) {
+		memcpy(f + flen, data, len);
+		flen += len;
+	}
+	crc = crc16(f, flen);
+	f[flen++] = crc & 0xFF;
+	f[flen++] = crc >> 8;
+
+	out[n++] = BINPROTO_END;
+	for (i = 0; i < flen; i++) {
+		slip_put(out, &n, f[i]);
+	}
+	out[n++] = BINPROTO_END;
+	send_all(out, n);
+
+	// Receive response frame
+	do {
+		if ((c = recv_byte()) < 0) return -1;
+	} while (c != BINPROTO_END);
+	flen = 0;
+	while (1) {
+		if ((c = recv_byte()) < 0) return -1;
+		if (c == BINPROTO_END) {
+			if (flen == 0) continue;
+			break;
+		}
+		if (c == BINPROTO_ESC) {
+			if ((c = recv_byte()) < 0) return -1;
+			c = (c == BINPROTO_ESC_END) ? BINPROTO_END : BINPROTO_ESC;
+		}
+		if (flen < sizeof(f)) f[flen++] = c;
+	}
+
+	if (flen < 6 || (f[flen - 2] | (f[flen - 1] << 8)) != crc16(f, flen - 2)
+			|| f[0] != (cmd | BINPROTO_RESPONSE)) {
+		return -1;
+	}
+	if (cmd == BINPROTO_CMD_READ && f[1] == BINPROTO_OK) {
+		memcpy(data, f + 4, f[3]);
+	}
+	return f[1];
+}
+
+static int cmd_read(void) {
+	uint8_t bank[BINPROTO_BANK_SIZE];
+	int i, status = transact(BINPROTO_CMD_READ, 0, sizeof(bank), bank);
+	if (status != BINPROTO_OK) {
+		fprintf(stderr, "read failed: %d\n", status);
+		return 1;
+	}
+	for (i = 0; i < BINPROTO_BANK_SIZE; i++) {
+		printf("%02X%s", bank[i], (i % 16 == 15) ? "\n" : " ");
+	}
+	return 0;
+}
+
+static int cmd_write(const char *addr_s, const char *hex) {
+	uint8_t data[BINPROTO_BANK_SIZE];
+	unsigned int v;
+	int len = 0, status;
+
+	while (hex[0] && hex[1] && len < BINPROTO_BANK_SIZE && sscanf(hex, "%2x", &v) == 1) {
+		data[len++] = v;
+		hex += 2;
+	}
+	status = transact(BINPROTO_CMD_WRITE_COMMIT, strtoul(addr_s, 0, 16), len, data);
+	if (status != BINPROTO_OK) {
+		fprintf(stderr, "write failed: %d\n", status);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Write the whole bank with text W commands and then with one binary
+ * write+commit frame. Each pass writes a fresh pattern so that every byte
+ * really changes.
+ */
+static int cmd_bench(void) {
+	uint8_t data[BINPROTO_BANK_SIZE];
+	char line[32];
+	double t0, t_text, t_bin;
+	int i, status;
+
+	// Text: one W command per byte, waiting for the prompt each time
+	send_all((const uint8_t *)"\r", 1);
+	wait_for("> ");
+	t0 = now_s();
+	for (i = 0; i < BINPROTO_BANK_SIZE; i++) {
+		int n = snprintf(line, sizeof(line), "W %02X %02X\r", i, (i * 7 + 1) & 0xFF);
+		send_all((const uint8_t *)line, n);
+		if (wait_for("> ") < 0) {
+			fprintf(stderr, "text: timeout at %d\n", i);
+			return 1;
+		}
+	}
+	t_text = now_s() - t0;
+
+	// Binary: one frame
+	for (i = 0; i < BINPROTO_BANK_SIZE; i++) {
+		data[i] = (i * 13 + 5) & 0xFF;
+	}
+	t0 = now_s();
+	status = transact(BINPROTO_CMD_WRITE_COMMIT, 0, sizeof(data), data);
+	t_bin = now_s() - t0;
+	if (status != BINPROTO_OK) {
+		fprintf(stderr, "binary: failed %d\n", status);
+		return 1;
+	}
+
+	printf("text   : %d bytes in %.3f s, %.1f bytes/s\n", BINPROTO_BANK_SIZE, t_text, BINPROTO_BANK_SIZE / t_text);
+	printf("binary : %d bytes in %.3f s, %.1f bytes/s\n", BINPROTO_BANK_SIZE, t_bin, BINPROTO_BANK_SIZE / t_bin);
+	return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Drive a scripted mix of text commands (three W for every R) and report
+ * round-trip latency percentiles and commands per second. Latency is from
+ * sending the command to receiving the next prompt.
+ */
+static int cmd_latency(int count) {
+	double *t = malloc(count * sizeof(double));
+	double t0, start;
+	char line[32];
+	int i, n;
+
+	send_all((const uint8_t *)"\r", 1);
+	if (wait_for("> ") < 0) {
+		fprintf(stderr, "no prompt\n");
+		return 1;
+	}
+
+	start = now_s();
+	for (i = 0; i < count; i++) {
+		if (i % 4 == 3) {
+			n = snprintf(line, sizeof(line), "R\r");
+		} else {
+			n = snprintf(line, sizeof(line), "W %02X %02X\r", (i * 5) % BINPROTO_BANK_SIZE, (i * 11 + 3) & 0xFF);
+		}
+		t0 = now_s();
+		send_all((const uint8_t *)line, n);
+		if (wait_for("> ") < 0) {
+			fprintf(stderr, "timeout at %d\n", i);
+			return 1;
+		}
+		t[i] = now_s() - t0;
+	}
+	start = now_s() - start;
+
+	qsort(t, count, sizeof(double), compare_double);
+	printf("commands : %d in %.3f s, %.1f commands/s\n", count, start, count / start);
+	printf("latency  : p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			t[count / 2] * 1e3, t[count * 9 / 10] * 1e3, t[count * 99 / 100] * 1e3, t[count - 1] * 1e3);
+	free(t);
+	return 0;
+}
+
+/*
+ * Read a decimal number, discarding the character that ends it
+ */
+static long recv_decimal(void) {
+	long v = 0;
+	int c;
+	while ((c = recv_byte()) >= '0' && c <= '9') {
+		v = v * 10 + c - '0';
+	}
+	return v;
+}
+
+/*
+ * Read the bank with the text R command
+ */
+static int read_bank_text(uint8_t *bank) {
+	unsigned int v;
+	char hex[3] = {0};
+	int i, j;
+
+	send_all((const uint8_t *)"R\r", 2);
+	if (wait_for("EEPROM page:\r\n") < 0) return -1;
+	for (i = 0; i < 4; i++) {
+		// Skip address
+		if (wait_for("  ") < 0) return -1;
+		for (j = 0; j < 16; j++) {
+			hex[0] = recv_byte();
+			hex[1] = recv_byte();
+			recv_byte();
+			if (sscanf(hex, "%2x", &v) != 1) return -1;
+			bank[i * 16 + j] = v;
+		}
+	}
+	return wait_for("> ");
+}
+
+/*
+ * Send W commands at a fixed rate, then reboot (which must flush any
+ * writes still staged) and check that the bank holds the last value
+ * written to each byte. Reports the page erases made during the storm
+ * (from the S command, so the device's statistics are reset).
+ */
+static int cmd_storm(int rate, int seconds) {
+	uint8_t expect[BINPROTO_BANK_SIZE], bank[BINPROTO_BANK_SIZE];
+	int i, n, count = rate * seconds, addr, val;
+	long erases;
+	double t0;
+	char line[32];
+
+	send_all((const uint8_t *)"\r", 1);
+	if (wait_for("> ") < 0 || read_bank_text(expect) < 0) {
+		fprintf(stderr, "no prompt\n");
+		return 1;
+	}
+	send_all((const uint8_t *)"S\r", 2);
+	wait_for("> ");
+
+	srand(1);
+	t0 = now_s();
+	for (i = 0; i < count; i++) {
+		// Hold to the requested rate
+		while (now_s() < t0 + (double)i / rate) {
+			usleep(100);
+		}
+		addr = rand() % BINPROTO_BANK_SIZE;
+		val = rand() & 0xFF;
+		expect[addr] = val;
+		n = snprintf(line, sizeof(line), "W %02X %02X\r", addr, val);
+		send_all((const uint8_t *)line, n);
+		if (wait_for("> ") < 0) {
+			fprintf(stderr, "timeout at %d\n", i);
+			return 1;
+		}
+	}
+	t0 = now_s() - t0;
+
+	send_all((const uint8_t *)"S\r", 2);
+	if (wait_for("erase page:\r\n calls: ") < 0) return 1;
+	erases = recv_decimal();
+	wait_for("> ");
+
+	send_all((const uint8_t *)"Z\r", 2);
+	if (wait_for("Commands:") < 0 || wait_for("> ") < 0 || read_bank_text(bank) < 0) {
+		fprintf(stderr, "no prompt after reboot\n");
+		return 1;
+	}
+
+	printf("writes   : %d in %.1f s, %.1f writes/s\n", count, t0, count / t0);
+	printf("erases   : %ld, %.0f erases/hour\n", erases, erases * 3600 / t0);
+	printf("bank     : %s after reboot\n", memcmp(bank, expect, sizeof(bank)) ? "MISMATCH" : "correct");
+	return memcmp(bank, expect, sizeof(bank)) != 0;
+}
+
+int main(int argc, char **argv) {
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <tty> read | write <addr> <hex> | bench | latency [count]"
+				" | storm [writes/s] [seconds]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open_tty(argv[1]);
+
+	if (strcmp(argv[2], "read") == 0) {
+		return cmd_read();
+	}
+	if (strcmp(argv[2], "write") == 0 && argc == 5) {
+		return cmd_write(argv[3], argv[4]);
+	}
+	if (strcmp(argv[2], "bench") == 0) {
+		return cmd_bench();
+	}
+	if (strcmp(argv[2], "latency") == 0) {
+		return cmd_latency(argc > 3 ? atoi(argv[3]) : 1000);
+	}
+	if (strcmp(argv[2], "storm") == 0) {
+		return cmd_storm(argc > 3 ? atoi(argv[3]) : 100, argc > 4 ? atoi(argv[4]) : 60);
+	}
+
+	fprintf(stderr, "unknown command\n");
+	return 1;
+}
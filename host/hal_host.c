@@ -0,0 +1,274 @@
+/*
+ * hal_host.c
+ *
+ * Linux host build of the console firmware. Provides hal.h, uart.h and
+ * systick.h on top of a pseudo-terminal and the system clock, and the IAP
+ * layer comes from the simulator (iap_sim.c), so that the unmodified
+ * command loop in LPC8xx_Flash_EEPROM.c can be driven by eeprom_client or
+ * a terminal program.
+ *
+ * The firmware's main() is renamed firmware_main() on the command line.
+ * Reset (Z command) jumps back to the start of firmware_main(): flash
+ * contents survive as they would on the device, and every module that
+ * keeps state in SRAM is re-initialised by its mount / init call.
+ *
+ * Build (Linux), in host/ (see Makefile for the sources):
+ *   make eeprom_host
+ *   make eeprom_host FEATURES='-DENABLE_LOG_STORE -DENABLE_KVSTORE'
+ *
+ * FEATURES defines the optional features (ENABLE_xxx in main) to build in.
+ * Rebuild after changing it: make -B eeprom_host FEATURES=...
+ *
+ * Usage:
+ *   eeprom_host [-r]
+ *
+ * The pty to connect to is printed on stderr. -r makes simulated flash
+ * operations take real time.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <setjmp.h>
+
+#include "hal.h"
+#include "uart.h"
+#include "systick.h"
+#include "iap_sim.h"
+
+#undef main
+
+int firmware_main(void);
+
+// Ticks per millisecond of hal_timer_now(), as the SCT on a 12MHz part
+#define HOST_TIMER_KHZ (12000)
+
+volatile struct uart_rx_stats uart_rx_stats;
+
+// pty master (console I/O) and slave (held open so that the master does
+// not see end of file whenever a client disconnects)
+static int pty_fd = -1;
+static int pty_slave_fd = -1;
+
+static jmp_buf reset_jmp;
+
+// Bytes received but not yet processed
+static uint8_t rxbuf[256];
+static uint32_t rxbuf_len, rxbuf_pos;
+
+// Line being assembled / handed to the caller of uart_read_line()
+static char rxline[UART_RX_LINE_SIZE];
+static uint32_t rxline_index;
+static int rxline_truncated;
+
+// Pending output, written to the pty in one go when waiting for input
+static uint8_t txbuf[1024];
+static uint32_t txbuf_len;
+
+static void (*uart_idle_hook)(void) = 0;
+static int (*uart_rx_hook)(uint8_t c) = 0;
+
+static struct timespec start_time;
+
+static uint64_t host_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)(ts.tv_sec - start_time.tv_sec) * 1000000
+			+ (ts.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+static void tx_flush(void) {
+	uint32_t done = 0;
+	while (done < txbuf_len) {
+		ssize_t n = write(pty_fd, txbuf + done, txbuf_len - done);
+		if (n <= 0) break;
+		done += n;
+	}
+	txbuf_len = 0;
+}
+
+/*---------------------------------------------------------------------------
+ * hal.h
+ */
+
+void hal_init(void) {
+}
+
+void hal_timer_init(void) {
+}
+
+/**
+ * @return Host time plus time spent in simulated IAP calls, in 12MHz ticks,
+ * so that timings reported by the firmware are those the device would see.
+ */
+uint32_t hal_timer_now(void) {
+	uint64_t us = host_us();
+	if ( ! iap_sim_timing.realtime) {
+		us += iap_sim_stats.time_us;
+	}
+	return (uint32_t)(us * (HOST_TIMER_KHZ / 1000));
+}
+
+void hal_reset(void) {
+	tx_flush();
+	longjmp(reset_jmp, 1);
+}
+
+/*---------------------------------------------------------------------------
+ * systick.h
+ */
+
+void systick_init(void) {
+}
+
+uint32_t systick_now(void) {
+	return (uint32_t)(host_us() / 1000);
+}
+
+/*---------------------------------------------------------------------------
+ * uart.h
+ */
+
+void uart_init(uint32_t baudrate) {
+	(void)baudrate;
+	rxline_index = 0;
+	rxline_truncated = 0;
+	txbuf_len = 0;
+	uart_idle_hook = 0;
+	uart_rx_hook = 0;
+}
+
+void uart_send_byte(uint8_t v) {
+	if (txbuf_len == sizeof(txbuf)) {
+		tx_flush();
+	}
+	txbuf[txbuf_len++] = v;
+}
+
+void uart_send_string_z(char *buf) {
+	while (*buf != 0) {
+		uart_send_byte(*buf++);
+	}
+}
+
+void uart_drain(void) {
+	tx_flush();
+}
+
+void uart_set_idle_hook(void (*hook)(void)) {
+	uart_idle_hook = hook;
+}
+
+void uart_set_rx_hook(int (*hook)(uint8_t c)) {
+	uart_rx_hook = hook;
+}
+
+/*
+ * Add a received byte to the current line, echoing it as the device does.
+ *
+ * @return 1 if the line is complete
+ */
+static int rx_line_byte(uint8_t c) {
+	if (c == '\r') {
+		rxline[rxline_index] = 0;
+		uart_send_string_z("\r\n");
+		return 1;
+	}
+	if (c > 31) {
+		if (rxline_index < UART_RX_LINE_SIZE - 1) {
+			rxline[rxline_index++] = c;
+		} else if ( ! rxline_truncated) {
+			uart_rx_stats.truncated++;
+			rxline_truncated = 1;
+		}
+		uart_send_byte(c);
+	}
+	return 0;
+}
+
+/**
+ * Wait for a CR terminated line. The idle hook is called at least every
+ * SYSTICK_PERIOD_MS while waiting.
+ */
+char *uart_read_line(uint32_t *len) {
+	struct pollfd p = { pty_fd, POLLIN, 0 };
+	ssize_t n;
+
+	rxline_index = 0;
+	rxline_truncated = 0;
+
+	while (1) {
+		while (rxbuf_pos < rxbuf_len) {
+			uint8_t c = rxbuf[rxbuf_pos++];
+			if (uart_rx_hook && uart_rx_hook(c)) {
+				continue;
+			}
+			if (rx_line_byte(c)) {
+				*len = rxline_index;
+				return rxline;
+			}
+		}
+
+		if (uart_idle_hook) {
+			uart_idle_hook();
+		}
+		tx_flush();
+
+		if (poll(&p, 1, SYSTICK_PERIOD_MS) > 0) {
+			n = read(pty_fd, rxbuf, sizeof(rxbuf));
+			rxbuf_pos = 0;
+			rxbuf_len = (n > 0) ? n : 0;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------
+ * Host entry point
+ */
+
+static void pty_open(void) {
+	struct termios t;
+	char *name;
+
+	pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty_fd < 0 || grantpt(pty_fd) != 0 || unlockpt(pty_fd) != 0
+			|| (name = ptsname(pty_fd)) == NULL) {
+		perror("pty");
+		exit(1);
+	}
+
+	// Raw mode, no echo or CR/LF translation, like a serial line
+	pty_slave_fd = open(name, O_RDWR | O_NOCTTY);
+	if (pty_slave_fd < 0 || tcgetattr(pty_slave_fd, &t) != 0) {
+		perror(name);
+		exit(1);
+	}
+	cfmakeraw(&t);
+	tcsetattr(pty_slave_fd, TCSANOW, &t);
+
+	fprintf(stderr, "console on %s\n", name);
+}
+
+int main(int argc, char **argv) {
+
+	if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+		iap_sim_timing.realtime = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	pty_open();
+
+	if (setjmp(reset_jmp) != 0) {
+		fprintf(stderr, "reset\n");
+		rxbuf_len = rxbuf_pos = 0;
+	}
+
+	return firmware_main();
+}
@@ -0,0 +1,507 @@
+/*
+ * iap_sim.c
+ *
+ * Host (Linux) replacement for iap_driver.c. Models LPC8xx flash as 64 byte
+ * pages in 1KiB sectors, with the ROM's rules:
+ *
+ *  - an erase or copy needs a prepare of every sector it touches first, and
+ *    the sectors are protected again after each successful erase / copy
+ *    (SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION otherwise);
+ *  - copies must be 64, 128, 256, 512 or 1024 bytes (COUNT_ERROR) from a
+ *    word aligned source (SRC_ADDR_ERROR) to a 64 byte aligned destination
+ *    (DST_ADDR_ERROR) in mapped flash (DST_ADDR_NOT_MAPPED);
+ *  - erase sets bytes to 0xFF, programming can only clear bits.
+ *
+ * Sector and page numbers are host addresses divided by the sector / page
+ * size, exactly as flash.c computes them on target, so the program must be
+ * linked non-PIE to keep its static data below 4GiB. Storage regions
+ * declared with FLASH_STORAGE are placed in the 'flash_storage' section
+ * when compiled with -DIAP_SIM and are mapped automatically; other memory
+ * can be added with iap_sim_map(). Anything else is INVALID_SECTOR.
+ *
+ * Time is simulated (see struct iap_sim_timing) and advances only in IAP
+ * calls, so iap_ticks() latencies are those of the modelled part and a run
+ * is not slowed down by them unless realtime is set. Every page has an
+ * erase counter for wear studies.
+ *
+ * Must be compiled with -DIAP_SIM and linked -no-pie with the storage
+ * modules: host/Makefile has the rules, for the host firmware and for the
+ * tests in host/tests/ (make test).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "flash.h"
+#include "iap_driver.h"
+#include "iap_stats.h"
+#include "iap_sim.h"
+
+struct iap_sim_timing iap_sim_timing = {
+	.call_us = 10,
+	.erase_page_us = 100000,
+	.erase_sector_us = 100000,
+	.copy_us = 1000,
+	.realtime = 0,
+};
+
+struct iap_sim_stats iap_sim_stats;
+
+// Bounds of the 'flash_storage' section (provided by the linker, weak so
+// that a program with no FLASH_STORAGE arrays still links)
+extern uint8_t __start_flash_storage[] __attribute__ ((weak));
+extern uint8_t __stop_flash_storage[] __attribute__ ((weak));
+
+struct sim_region {
+	uintptr_t start;
+	uintptr_t end;
+	uint32_t *erases;	// erase count per page
+};
+
+static struct sim_region regions[IAP_SIM_MAX_REGIONS];
+static int n_regions;
+static int initialised;
+
+// Sector range enabled by the last prepare (none if prepared == 0)
+static int prepared;
+static uint32_t prepared_start, prepared_end;
+
+// Number of erase / copy operations until a simulated power failure
+// (-1 for never) and whether the part is currently 'off'
+static int64_t ops_to_failure = -1;
+static int powered_off;
+
+static uint64_t sim_time_us;
+
+/*
+ * Find the region fully containing [addr, addr+len), or NULL
+ */
+static struct sim_region *find_region(uintptr_t addr, uintptr_t len) {
+	int i;
+	for (i = 0; i < n_regions; i++) {
+		if (addr >= regions[i].start && addr + len <= regions[i].end) {
+			return &regions[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Test if any mapped flash is in a sector
+ */
+static int sector_is_mapped(uint32_t sector) {
+	uintptr_t s = (uintptr_t)sector * FLASH_SECTOR_SIZE;
+	int i;
+	for (i = 0; i < n_regions; i++) {
+		if (s < regions[i].end && s + FLASH_SECTOR_SIZE > regions[i].start) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int sectors_are_prepared(uint32_t start, uint32_t end) {
+	return prepared && start >= prepared_start && end <= prepared_end;
+}
+
+/*
+ * Advance simulated time (and optionally real time)
+ */
+static void spend(uint64_t us) {
+	sim_time_us += us;
+	iap_sim_stats.time_us += us;
+	if (iap_sim_timing.realtime && us > 0) {
+		struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Account for a write operation against a pending power failure.
+ *
+ * @return 1 if this operation is cut short by the failure
+ */
+static int power_fails(void) {
+	if (ops_to_failure < 0) return 0;
+	if (ops_to_failure-- > 0) return 0;
+	powered_off = 1;
+	return 1;
+}
+
+/*
+ * Erase whole pages [page_start, page_end], all known to be mapped.
+ *
+ * @return 1 if the erase was torn by a power failure
+ */
+static int erase_pages(uint32_t page_start, uint32_t page_end) {
+	uint32_t page, n = page_end - page_start + 1;
+	int torn = power_fails();
+
+	// A power failure erases only the first half of the range
+	if (torn) {
+		n /= 2;
+	}
+	for (page = page_start; page < page_start + n; page++) {
+		uintptr_t addr = (uintptr_t)page * FLASH_PAGE_SIZE;
+		struct sim_region *r = find_region(addr, FLASH_PAGE_SIZE);
+		memset((void *)addr, FLASH_ERASED_BYTE, FLASH_PAGE_SIZE);
+		r->erases[(addr - r->start) / FLASH_PAGE_SIZE]++;
+		iap_sim_stats.page_erases++;
+	}
+	return torn;
+}
+
+/*
+ * Common tail of every call: charge time, count errors and record latency
+ */
+static int finish(uint32_t op, uint64_t us, int status) {
+	uint32_t start = iap_ticks();
+	spend(iap_sim_timing.call_us + (status == CMD_SUCCESS ? us : 0));
+	if (status != CMD_SUCCESS) iap_sim_stats.errors++;
+	iap_stats_record(op, iap_ticks() - start, status);
+	return status;
+}
+
+/*---------------------------------------------------------------------------
+ * Simulator control
+ */
+
+/**
+ * Map the 'flash_storage' section. Called automatically by iap_init(); it
+ * only needs calling directly to map further regions before the first
+ * iap_init().
+ */
+void iap_sim_init(void) {
+	uintptr_t start = (uintptr_t)__start_flash_storage;
+	uintptr_t stop = (uintptr_t)__stop_flash_storage;
+
+	if (initialised) return;
+	initialised = 1;
+	if (start != 0 && stop > start) {
+		iap_sim_map(__start_flash_storage, stop - start);
+	}
+}
+
+/**
+ * Make a block of host memory behave as flash. The memory is made writable.
+ *
+ * @param base Start address. Must be 64 byte aligned and below 4GiB.
+ * @param size Size in bytes. Must be a multiple of 64.
+ *
+ * @return 0 for success, -1 if base or size are unsuitable or there are
+ * too many regions.
+ */
+int iap_sim_map(const void *base, uint32_t size) {
+	uintptr_t start = (uintptr_t)base;
+	uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+	uintptr_t lo = start & ~(pagesize - 1);
+	uintptr_t hi = (start + size + pagesize - 1) & ~(pagesize - 1);
+	struct sim_region *r;
+
+	if ((start % FLASH_PAGE_SIZE) != 0 || (size % FLASH_PAGE_SIZE) != 0
+			|| size == 0 || start + size > 0xFFFFFFFFu
+			|| n_regions == IAP_SIM_MAX_REGIONS) {
+		fprintf(stderr, "iap_sim: can't map %p + %u\n", base, size);
+		return -1;
+	}
+
+	if (mprotect((void *)lo, hi - lo, PROT_READ | PROT_WRITE) != 0) {
+		perror("iap_sim: mprotect");
+		return -1;
+	}
+
+	r = &regions[n_regions++];
+	r->start = start;
+	r->end = start + size;
+	r->erases = calloc(size / FLASH_PAGE_SIZE, sizeof(uint32_t));
+	return 0;
+}
+
+/**
+ * @return Number of times the page containing addr has been erased, or 0
+ * if it is not mapped.
+ */
+uint32_t iap_sim_erase_count(const void *addr) {
+	struct sim_region *r = find_region((uintptr_t)addr, 1);
+	if (r == NULL) return 0;
+	return r->erases[((uintptr_t)addr - r->start) / FLASH_PAGE_SIZE];
+}
+
+/**
+ * @return Highest erase count of any mapped page.
+ */
+uint32_t iap_sim_max_erase_count(void) {
+	uint32_t max = 0, i;
+	int j;
+	for (j = 0; j < n_regions; j++) {
+		for (i = 0; i < (regions[j].end - regions[j].start) / FLASH_PAGE_SIZE; i++) {
+			if (regions[j].erases[i] > max) max = regions[j].erases[i];
+		}
+	}
+	return max;
+}
+
+/**
+ * Clear the totals in iap_sim_stats and all page erase counts.
+ */
+void iap_sim_reset_stats(void) {
+	int j;
+	memset(&iap_sim_stats, 0, sizeof(iap_sim_stats));
+	for (j = 0; j < n_regions; j++) {
+		memset(regions[j].erases, 0,
+				(regions[j].end - regions[j].start) / FLASH_PAGE_SIZE * sizeof(uint32_t));
+	}
+}
+
+/**
+ * Simulate a power failure. The next ops erase / copy calls complete
+ * normally, the one after that is torn (only the first half of its pages
+ * or bytes are written, BUSY is returned) and every later call returns
+ * BUSY until
+ * iap_sim_power_on(). Flash contents are kept, so the test can then
+ * re-mount the storage and check what survived.
+ *
+ * @param ops Number of erase / copy calls to complete before the failure
+ */
+void iap_sim_fail_after(uint32_t ops) {
+	ops_to_failure = ops;
+}
+
+/**
+ * Restore power after a simulated failure. Any prepare is lost.
+ */
+void iap_sim_power_on(void) {
+	ops_to_failure = -1;
+	powered_off = 0;
+	prepared = 0;
+}
+
+/*---------------------------------------------------------------------------
+ * iap_driver.h API
+ */
+
+/**
+ * Read simulated timer used for IAP statistics.
+ *
+ * @return Simulated SCT count (IAP_SIM_TICKS_PER_US per microsecond)
+ */
+uint32_t iap_ticks(void) {
+	return (uint32_t)(sim_time_us * IAP_SIM_TICKS_PER_US);
+}
+
+/**
+ * Init IAP driver
+ * @return    0 for success
+ */
+int iap_init(void) {
+	iap_sim_init();
+	return 0;
+}
+
+/**
+ * Erase flash sector(s). Each sector must be entirely mapped.
+ *
+ * @return CMD_SUCCESS, BUSY, SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION,
+ *         or INVALID_SECTOR
+ */
+int iap_erase_sector(unsigned int sector_start, unsigned int sector_end) {
+	uint32_t s;
+
+	if (powered_off) return finish(IAP_OP_ERASE_SECTOR, 0, BUSY);
+	if (sector_end < sector_start) return finish(IAP_OP_ERASE_SECTOR, 0, INVALID_SECTOR);
+	for (s = sector_start; s <= sector_end; s++) {
+		if (find_region((uintptr_t)s * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE) == NULL) {
+			return finish(IAP_OP_ERASE_SECTOR, 0, INVALID_SECTOR);
+		}
+	}
+	if ( ! sectors_are_prepared(sector_start, sector_end)) {
+		return finish(IAP_OP_ERASE_SECTOR, 0, SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION);
+	}
+
+	if (erase_pages(sector_start * FLASH_PAGES_PER_SECTOR,
+			(sector_end + 1) * FLASH_PAGES_PER_SECTOR - 1)) {
+		return finish(IAP_OP_ERASE_SECTOR, 0, BUSY);
+	}
+	iap_sim_stats.sector_erases += sector_end - sector_start + 1;
+	prepared = 0;
+
+	return finish(IAP_OP_ERASE_SECTOR,
+			(uint64_t)(sector_end - sector_start + 1) * iap_sim_timing.erase_sector_us,
+			CMD_SUCCESS);
+}
+
+/**
+ * Erase flash page(s). Each page must be mapped.
+ *
+ * @return CMD_SUCCESS, BUSY, SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION,
+ *         or INVALID_SECTOR
+ */
+int iap_erase_page(unsigned int page_start, unsigned int page_end) {
+	uint32_t p;
+
+	if (powered_off) return finish(IAP_OP_ERASE_PAGE, 0, BUSY);
+	if (page_end < page_start) return finish(IAP_OP_ERASE_PAGE, 0, INVALID_SECTOR);
+	for (p = page_start; p <= page_end; p++) {
+		if (find_region((uintptr_t)p * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE) == NULL) {
+			return finish(IAP_OP_ERASE_PAGE, 0, INVALID_SECTOR);
+		}
+	}
+	if ( ! sectors_are_prepared(page_start / FLASH_PAGES_PER_SECTOR,
+			page_end / FLASH_PAGES_PER_SECTOR)) {
+		return finish(IAP_OP_ERASE_PAGE, 0, SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION);
+	}
+
+	if (erase_pages(page_start, page_end)) return finish(IAP_OP_ERASE_PAGE, 0, BUSY);
+	prepared = 0;
+
+	return finish(IAP_OP_ERASE_PAGE,
+			(uint64_t)(page_end - page_start + 1) * iap_sim_timing.erase_page_us,
+			CMD_SUCCESS);
+}
+
+/**
+ * Prepare flash sector(s) for erase / writing. Every sector must hold
+ * some mapped flash.
+ *
+ * @return CMD_SUCCESS, BUSY, or INVALID_SECTOR
+ */
+int iap_prepare_sector(unsigned int sector_start, unsigned int sector_end) {
+	uint32_t s;
+
+	if (powered_off) return finish(IAP_OP_PREPARE, 0, BUSY);
+	if (sector_end < sector_start) return finish(IAP_OP_PREPARE, 0, INVALID_SECTOR);
+	for (s = sector_start; s <= sector_end; s++) {
+		if ( ! sector_is_mapped(s)) return finish(IAP_OP_PREPARE, 0, INVALID_SECTOR);
+	}
+
+	prepared = 1;
+	prepared_start = sector_start;
+	prepared_end = sector_end;
+	iap_sim_stats.prepares++;
+
+	return finish(IAP_OP_PREPARE, 0, CMD_SUCCESS);
+}
+
+/**
+ * Blank check flash sector(s). Each sector must be entirely mapped. No
+ * prepare is needed.
+ *
+ * @return CMD_SUCCESS, BUSY, SECTOR_NOT_BLANK, or INVALID_SECTOR
+ */
+int iap_blank_check_sector(unsigned int sector_start, unsigned int sector_end) {
+	uint32_t s;
+
+	if (powered_off) return finish(IAP_OP_BLANK_CHECK, 0, BUSY);
+	if (sector_end < sector_start) return finish(IAP_OP_BLANK_CHECK, 0, INVALID_SECTOR);
+	for (s = sector_start; s <= sector_end; s++) {
+		if (find_region((uintptr_t)s * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE) == NULL) {
+			return finish(IAP_OP_BLANK_CHECK, 0, INVALID_SECTOR);
+		}
+	}
+	for (s = sector_start * FLASH_PAGES_PER_SECTOR; s < (sector_end + 1) * FLASH_PAGES_PER_SECTOR; s++) {
+		if ( ! flash_page_is_blank((const void *)((uintptr_t)s * FLASH_PAGE_SIZE))) {
+			return finish(IAP_OP_BLANK_CHECK, 0, SECTOR_NOT_BLANK);
+		}
+	}
+	return finish(IAP_OP_BLANK_CHECK, 0, CMD_SUCCESS);
+}
+
+/**
+ * Copy RAM contents into flash. Bits already 0 in flash stay 0.
+ *
+ * @return CMD_SUCCESS, BUSY, COUNT_ERROR, SRC_ADDR_ERROR, DST_ADDR_ERROR,
+ *         DST_ADDR_NOT_MAPPED or SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION
+ */
+int iap_copy_ram_to_flash(void* ram_address, void* flash_address,
+		unsigned int count) {
+	uintptr_t dst = (uintptr_t)flash_address;
+	const uint8_t *src = (const uint8_t *)ram_address;
+	uint8_t *f = (uint8_t *)flash_address;
+	uint32_t i;
+	int torn;
+
+	if (powered_off) return finish(IAP_OP_COPY, 0, BUSY);
+	if (count != 64 && count != 128 && count != 256 && count != 512 && count != 1024) {
+		return finish(IAP_OP_COPY, 0, COUNT_ERROR);
+	}
+	if (((uintptr_t)ram_address % 4) != 0) return finish(IAP_OP_COPY, 0, SRC_ADDR_ERROR);
+	if ((dst % FLASH_PAGE_SIZE) != 0) return finish(IAP_OP_COPY, 0, DST_ADDR_ERROR);
+	if (find_region(dst, count) == NULL) return finish(IAP_OP_COPY, 0, DST_ADDR_NOT_MAPPED);
+	if ( ! sectors_are_prepared(FLASH_SECTOR_OF(dst), FLASH_SECTOR_OF(dst + count - 1))) {
+		return finish(IAP_OP_COPY, 0, SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION);
+	}
+
+	// A power failure programs only the first half of the bytes
+	torn = power_fails();
+	for (i = 0; i < (torn ? count / 2 : count); i++) {
+		f[i] &= src[i];
+	}
+	if (torn) return finish(IAP_OP_COPY, 0, BUSY);
+	iap_sim_stats.copies++;
+	iap_sim_stats.bytes_programmed += count;
+	prepared = 0;
+
+	return finish(IAP_OP_COPY, iap_sim_timing.copy_us, CMD_SUCCESS);
+}
+
+/**
+ * Compare memory. Any host memory can be compared.
+ *
+ * @return CMD_SUCCESS, BUSY, COMPARE_ERROR, COUNT_ERROR, SRC_ADDR_ERROR
+ *         or DST_ADDR_ERROR
+ */
+int iap_compare(const void *dst, const void *src, unsigned int count,
+		uint32_t *offset) {
+	const uint32_t *d = (const uint32_t *)dst, *s = (const uint32_t *)src;
+	uint32_t i;
+
+	if (powered_off) return finish(IAP_OP_COMPARE, 0, BUSY);
+	if ((count % 4) != 0) return finish(IAP_OP_COMPARE, 0, COUNT_ERROR);
+	if (((uintptr_t)src % 4) != 0) return finish(IAP_OP_COMPARE, 0, SRC_ADDR_ERROR);
+	if (((uintptr_t)dst % 4) != 0) return finish(IAP_OP_COMPARE, 0, DST_ADDR_ERROR);
+
+	for (i = 0; i < count / 4; i++) {
+		if (d[i] != s[i]) {
+			*offset = i * 4;
+			return finish(IAP_OP_COMPARE, 0, COMPARE_ERROR);
+		}
+	}
+	return finish(IAP_OP_COMPARE, 0, CMD_SUCCESS);
+}
+
+/**
+ * Read part ID (an LPC810M021FN8)
+ *
+ * @return CMD_SUCCESS
+ */
+int iap_read_part_id(uint32_t *part_id) {
+	*part_id = 0x00008100;
+	return CMD_SUCCESS;
+}
+
+/**
+ * Read Bootcode revision no
+ *
+ * @return CMD_SUCCESS
+ */
+int iap_read_bootcode_rev(uint32_t *bootcode_rev) {
+	*bootcode_rev = 0x00000D04;
+	return CMD_SUCCESS;
+}
+
+/**
+ * Read device's unique ID no (fixed in the simulator)
+ *
+ * @return CMD_SUCCESS
+ */
+int iap_read_unique_id(uint32_t *unique_id) {
+	unique_id[0] = 0x1A2B3C4D;
+	unique_id[1] = 0x00000000;
+	unique_id[2] = 0x00000000;
+	unique_id[3] = 0x00000001;
+	return CMD_SUCCESS;
+}
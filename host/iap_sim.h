@@ -0,0 +1,54 @@
+/*
+ * iap_sim.h
+ *
+ * Host (Linux) simulator of the LPC8xx IAP flash functions. host/iap_sim.c
+ * implements the iap_driver.h API against ordinary host memory so that the
+ * flash storage code in src/ can be run, benchmarked and regression tested
+ * off-target. See iap_sim.c for build notes.
+ */
+
+#ifndef IAP_SIM_H_
+#define IAP_SIM_H_
+
+#include <stdint.h>
+
+// Simulated SCT clock (ticks per microsecond) returned by iap_ticks()
+#define IAP_SIM_TICKS_PER_US (12)
+
+// Maximum number of separately mapped flash regions
+#define IAP_SIM_MAX_REGIONS (8)
+
+// Simulated duration of each ROM call in microseconds. Defaults are the
+// LPC800 datasheet figures (100ms page/sector erase, 1ms program).
+struct iap_sim_timing {
+	uint32_t call_us;		// overhead of any call (including prepare and failed calls)
+	uint32_t erase_page_us;		// per page erased by iap_erase_page()
+	uint32_t erase_sector_us;	// per sector erased by iap_erase_sector()
+	uint32_t copy_us;		// per iap_copy_ram_to_flash() call
+	int realtime;			// nonzero: also sleep for the simulated time
+};
+
+extern struct iap_sim_timing iap_sim_timing;
+
+// Totals since start (or iap_sim_reset_stats())
+struct iap_sim_stats {
+	uint32_t prepares;
+	uint32_t page_erases;	// pages erased, by page or sector erase
+	uint32_t sector_erases;
+	uint32_t copies;
+	uint32_t bytes_programmed;
+	uint32_t errors;	// calls returning other than CMD_SUCCESS
+	uint64_t time_us;	// simulated time spent in IAP calls
+};
+
+extern struct iap_sim_stats iap_sim_stats;
+
+void iap_sim_init(void);
+int iap_sim_map(const void *base, uint32_t size);
+uint32_t iap_sim_erase_count(const void *addr);
+uint32_t iap_sim_max_erase_count(void);
+void iap_sim_reset_stats(void);
+void iap_sim_fail_after(uint32_t ops);
+void iap_sim_power_on(void);
+
+#endif /* IAP_SIM_H_ */
@@ -0,0 +1,43 @@
+/*
+ * test.c
+ *
+ * Support for the host tests: the clock and the pass / fail report.
+ */
+
+#include "systick.h"
+#include "iap_driver.h"
+#include "test.h"
+
+int test_failures;
+uint32_t test_ms;
+
+void systick_init(void) {
+}
+
+uint32_t systick_now(void) {
+	return test_ms;
+}
+
+/**
+ * Map the flash storage of every module. Call first.
+ */
+void test_init(void) {
+	iap_init();
+}
+
+/**
+ * @return Simulated time spent in IAP calls so far, in ms.
+ */
+double test_sim_ms(void) {
+	return iap_sim_stats.time_us / 1000.0;
+}
+
+/**
+ * Print the outcome of a test.
+ *
+ * @return Exit status for main()
+ */
+int test_result(const char *name) {
+	printf("%s: %s\n", name, test_failures ? "FAIL" : "pass");
+	return test_failures != 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * test.h
+ *
+ * Support for the host tests (host/tests/test_*.c, run by 'make test' in
+ * host/). Each test is a program that returns non-zero if any CHECK()
+ * failed. Flash is the IAP simulator; time is test_ms, which the test
+ * moves on itself.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "iap_sim.h"
+
+// Record a failure (and carry on) if cond is false
+#define CHECK(cond) do { \
+	if ( ! (cond)) { \
+		fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+extern int test_failures;
+
+// Value returned by systick_now()
+extern uint32_t test_ms;
+
+void test_init(void);
+double test_sim_ms(void);
+int test_result(const char *name);
+
+#endif /* TEST_H_ */
@@ -0,0 +1,84 @@
+/*
+ * test_crc.c
+ *
+ * CRC-16/CCITT (crc.c, table lookup in the host build): the standard
+ * check value, agreement with a bit at a time reference over random
+ * buffers, and a calculation continued over split buffers with
+ * crc16_update() giving the CRC of the whole. Reports host time per byte
+ * over 64 to 1024 bytes. The CRC engine can only be timed on target (C
+ * command).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc.h"
+#include "test.h"
+
+/*
+ * Polynomial 0x1021, a bit at a time
+ */
+static uint16_t crc16_bitwise(uint16_t crc, const uint8_t *data, uint32_t len) {
+	int i;
+
+	while (len--) {
+		crc ^= (uint16_t)*data++ << 8;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static double host_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int main(void) {
+	static uint8_t buf[1024];
+	uint32_t i, j, len, split, runs;
+	uint16_t crc;
+	volatile uint16_t sink = 0;
+	double t;
+
+	crc_init();
+
+	// CRC-16/CCITT-FALSE check value
+	CHECK(crc16((const uint8_t *)"123456789", 9) == 0x29B1);
+	CHECK(crc16(buf, 0) == CRC16_INIT);
+
+	srand(1);
+	for (i = 0; i < 20000; i++) {
+		len = rand() % (sizeof(buf) + 1);
+		for (j = 0; j < len; j++) {
+			buf[j] = rand();
+		}
+		crc = crc16(buf, len);
+		CHECK(crc == crc16_bitwise(CRC16_INIT, buf, len));
+
+		// Continued over two parts
+		split = len ? rand() % (len + 1) : 0;
+		CHECK(crc16_update(crc16_update(CRC16_INIT, buf, split), buf + split, len - split) == crc);
+	}
+
+	// Continued a byte at a time
+	crc = CRC16_INIT;
+	for (i = 0; i < sizeof(buf); i++) {
+		crc = crc16_update(crc, buf + i, 1);
+	}
+	CHECK(crc == crc16(buf, sizeof(buf)));
+
+	for (len = 64; len <= sizeof(buf); len *= 2) {
+		runs = 1000000 / len;
+		t = host_ns();
+		for (i = 0; i < runs; i++) {
+			sink += crc16(buf, len);
+		}
+		printf("%4u bytes: table %.2f ns/byte (host)\n", len, (host_ns() - t) / runs / len);
+	}
+
+	return test_result("crc");
+}
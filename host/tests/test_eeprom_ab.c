@@ -0,0 +1,106 @@
+/*
+ * test_eeprom_ab.c
+ *
+ * A/B bank (eeprom_ab.c) power failure test. Each commit of a series is
+ * repeated with the power failing at every erase / copy it makes (torn:
+ * only half done), with and without the idle erase of the inactive slot.
+ * After power on the mount must give exactly the old or the new image.
+ * Also reports mount time.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "flash.h"
+#include "eeprom_ab.h"
+#include "test.h"
+
+#define COMMITS (6)
+
+static uint8_t image[COMMITS + 1][EEPROM_AB_SIZE] __attribute__ ((aligned (4)));
+
+static int bank_is(const uint8_t *data) {
+	return memcmp(eeprom_ab_data(), data, EEPROM_AB_SIZE) == 0;
+}
+
+/*
+ * Bring the bank to image[n] with no failures
+ */
+static void commit_to(uint32_t n, int idle) {
+	uint32_t i;
+
+	CHECK(eeprom_ab_format() == 0);
+	for (i = 1; i <= n; i++) {
+		if (idle) CHECK(eeprom_ab_idle() == 0);
+		CHECK(eeprom_ab_commit(image[i]) == 0);
+	}
+	CHECK(bank_is(image[n]));
+}
+
+/*
+ * Commit image[n] over image[n-1] with the power failing after ops erase /
+ * copy calls.
+ *
+ * @return 1 if the commit completed before the failure
+ */
+static int interrupted_commit(uint32_t n, uint32_t ops, int idle) {
+	uint32_t seq;
+	int32_t status;
+
+	commit_to(n - 1, idle);
+	seq = eeprom_ab_seq();
+
+	iap_sim_fail_after(ops);
+	if (idle) eeprom_ab_idle();
+	status = eeprom_ab_commit(image[n]);
+	iap_sim_power_on();
+
+	// Reboot
+	CHECK(eeprom_ab_mount() == 0);
+	CHECK(bank_is(image[n - 1]) || bank_is(image[n]));
+	if (bank_is(image[n])) {
+		CHECK(eeprom_ab_seq() == seq + 1);
+	} else {
+		CHECK(eeprom_ab_seq() == seq);
+	}
+	return status == 0;
+}
+
+int main(void) {
+	struct timespec t0, t1;
+	uint32_t i, j, n, ops, calls, points = 0;
+	int idle;
+
+	test_init();
+	for (i = 1; i <= COMMITS; i++) {
+		for (j = 0; j < EEPROM_AB_SIZE; j++) {
+			image[i][j] = i * 37 + j;
+		}
+	}
+
+	// Every interruption point of every commit of the series
+	for (idle = 0; idle <= 1; idle++) {
+		for (n = 1; n <= COMMITS; n++) {
+			for (ops = 0; ! interrupted_commit(n, ops, idle); ops++) {
+				points++;
+			}
+		}
+	}
+	printf("%u interruption points: old or new image after each\n", points);
+	CHECK(points > 0);
+
+	// Mount time: a header check and a CRC of the data per slot, no IAP
+	commit_to(COMMITS, 1);
+	calls = iap_sim_stats.prepares + iap_sim_stats.copies + iap_sim_stats.page_erases;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < 100000; i++) {
+		eeprom_ab_mount();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	CHECK(bank_is(image[COMMITS]));
+	CHECK(iap_sim_stats.prepares + iap_sim_stats.copies + iap_sim_stats.page_erases == calls);
+	printf("mount: %.0f ns (host), no IAP calls\n",
+			((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 100000);
+
+	return test_result("eeprom_ab");
+}
@@ -0,0 +1,118 @@
+/*
+ * test_eeprom_bank.c
+ *
+ * Named banks (eeprom_bank.c): every bank declared with EEPROM_BANK() must
+ * be page aligned (sector aligned if a sector or more), must not overlap
+ * another bank or the program's code, and writes to one bank must neither
+ * erase nor change any page outside the pages written. On the device
+ * placement is the linker's; here the banks are in the flash_storage
+ * section of the host program.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_bank.h"
+#include "test.h"
+
+// Bounds of the program's code (GNU ld)
+extern const char __executable_start[], etext[];
+extern uint8_t __start_flash_storage[], __stop_flash_storage[];
+
+EEPROM_BANK(cold_bank, 128);
+EEPROM_BANK(hot_bank, 64);
+EEPROM_BANK(odd_bank, 192);
+EEPROM_BANK(big_bank, 2048);
+
+static const struct eeprom_bank *banks[] = {&cold_bank, &hot_bank, &odd_bank, &big_bank};
+#define N_BANKS (sizeof(banks) / sizeof(banks[0]))
+
+static uint8_t expect[N_BANKS][2048];
+static uint32_t erases[N_BANKS][2048 / FLASH_PAGE_SIZE];
+
+static int overlaps(uintptr_t a, uint32_t a_len, uintptr_t b, uint32_t b_len) {
+	return a < b + b_len && b < a + a_len;
+}
+
+/*
+ * Write to bank i (and the model), then check that every other page of
+ * every bank kept its contents and erase count.
+ */
+static void write(uint32_t i, uint32_t offset, const uint8_t *data, uint32_t len) {
+	const struct eeprom_bank *b;
+	uint32_t j, p;
+
+	CHECK(eeprom_bank_write(banks[i], offset, data, len) == 0);
+	memcpy(expect[i] + offset, data, len);
+
+	for (j = 0; j < N_BANKS; j++) {
+		b = banks[j];
+		CHECK(memcmp(eeprom_bank_data(b), expect[j], b->size) == 0);
+		for (p = 0; p < b->size / FLASH_PAGE_SIZE; p++) {
+			uint32_t count = iap_sim_erase_count(b->flash + p * FLASH_PAGE_SIZE);
+			int written = j == i && overlaps(p * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE, offset, len);
+			if ( ! written) {
+				CHECK(count == erases[j][p]);
+			}
+			erases[j][p] = count;
+		}
+	}
+}
+
+int main(void) {
+	const struct eeprom_bank *b;
+	uint8_t data[2048];
+	uint32_t i, j, n;
+
+	test_init();
+
+	// Placement
+	for (i = 0; i < N_BANKS; i++) {
+		b = banks[i];
+		CHECK((uintptr_t)b->flash % EEPROM_BANK_ALIGN(b->size) == 0);
+		CHECK((uintptr_t)b->flash >= (uintptr_t)__start_flash_storage
+				&& (uintptr_t)b->flash + b->size <= (uintptr_t)__stop_flash_storage);
+		CHECK( ! overlaps((uintptr_t)b->flash, b->size, (uintptr_t)__executable_start,
+				etext - __executable_start));
+		for (j = 0; j < i; j++) {
+			CHECK( ! overlaps((uintptr_t)b->flash, b->size,
+					(uintptr_t)banks[j]->flash, banks[j]->size));
+		}
+		printf("%-12s %5u bytes at 0x%08lx\n", b->name, b->size, (unsigned long)b->flash);
+	}
+	CHECK((uintptr_t)big_bank.flash % FLASH_SECTOR_SIZE == 0);
+
+	for (i = 0; i < N_BANKS; i++) {
+		CHECK(eeprom_bank_format(banks[i]) == 0);
+		memset(expect[i], FLASH_ERASED_BYTE, banks[i]->size);
+	}
+	write(0, 0, (const uint8_t *)"cold config", 11);
+	write(3, 0, expect[3], 0);
+
+	// Hot counter: every write needs an erase of its page, and only that
+	for (n = 0; n < 500; n++) {
+		write(1, 0, (const uint8_t *)&n, sizeof(n));
+	}
+	CHECK(iap_sim_erase_count(hot_bank.flash) >= 499);
+	printf("500 hot bank writes: %u erases of the hot page, none elsewhere\n",
+			iap_sim_erase_count(hot_bank.flash));
+
+	// Across a page boundary: two pages of three
+	write(2, 60, (const uint8_t *)"straddles!", 10);
+
+	// Whole bank of two sectors
+	srand(1);
+	for (i = 0; i < sizeof(data); i++) data[i] = rand();
+	write(3, 0, data, sizeof(data));
+	write(3, 1000, data, 100);
+
+	// Outside the bank
+	CHECK(eeprom_bank_write(&cold_bank, 128, data, 1) == -1);
+	CHECK(eeprom_bank_write(&cold_bank, 127, data, 2) == -1);
+	CHECK(eeprom_bank_write(&cold_bank, 0xFFFFFFFF, data, 2) == -1);
+	write(0, 128, data, 0);
+	write(0, 120, data, 8);
+
+	return test_result("eeprom_bank");
+}
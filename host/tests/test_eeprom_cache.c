@@ -0,0 +1,82 @@
+/*
+ * test_eeprom_cache.c
+ *
+ * Write-back cache (eeprom_cache.c) over a flash page: N byte writes must
+ * collapse into a single commit on flush or idle timeout, and writes that
+ * leave the bank unchanged must cost nothing.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_cache.h"
+#include "test.h"
+
+static const uint8_t bank[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static uint32_t commits;
+
+static const uint8_t *bank_source(void) {
+	return FLASH_CONTENTS(bank);
+}
+
+static int32_t bank_commit(uint8_t *data) {
+	commits++;
+	return flash_write_page(bank, data);
+}
+
+int main(void) {
+	uint8_t expect[FLASH_PAGE_SIZE];
+	uint32_t i, copies;
+
+	test_init();
+	flash_format(bank, sizeof(bank));
+	memset(expect, FLASH_ERASED_BYTE, sizeof(expect));
+	eeprom_cache_init(bank_source, bank_commit);
+
+	// Writes of the value already there are absorbed
+	for (i = 0; i < FLASH_PAGE_SIZE; i++) {
+		eeprom_cache_write(i, FLASH_ERASED_BYTE);
+	}
+	CHECK(eeprom_cache_dirty_count() == 0);
+	CHECK(eeprom_cache_flush() == 0);
+	CHECK(commits == 0);
+
+	// N writes, one commit on flush
+	copies = iap_sim_stats.copies;
+	for (i = 0; i < 32; i++) {
+		eeprom_cache_write(i, i);
+		expect[i] = i;
+	}
+	CHECK(eeprom_cache_dirty_count() == 32);
+	CHECK(memcmp(bank_source(), expect, sizeof(expect)) != 0);
+	CHECK(eeprom_cache_flush() == 0);
+	CHECK(commits == 1);
+	CHECK(iap_sim_stats.copies - copies == 1);
+	CHECK(memcmp(bank_source(), expect, sizeof(expect)) == 0);
+	printf("32 byte writes: %u commit, %u copy\n", commits, iap_sim_stats.copies - copies);
+
+	// A byte set and then set back is not dirty
+	eeprom_cache_write(40, 0x12);
+	eeprom_cache_write(40, FLASH_ERASED_BYTE);
+	CHECK(eeprom_cache_dirty_count() == 0);
+
+	// Idle timeout: nothing until EEPROM_CACHE_IDLE_MS after the last write
+	for (i = 0; i < 10; i++) {
+		eeprom_cache_write(50 + i, 0xA0 + i);
+		expect[50 + i] = 0xA0 + i;
+		test_ms += 100;
+		CHECK(eeprom_cache_idle() == 0);
+	}
+	CHECK(commits == 1);
+	test_ms += EEPROM_CACHE_IDLE_MS;
+	CHECK(eeprom_cache_idle() == 0);
+	CHECK(commits == 2);
+	CHECK(memcmp(bank_source(), expect, sizeof(expect)) == 0);
+
+	// Reload from flash (as after reboot)
+	eeprom_cache_init(bank_source, bank_commit);
+	CHECK(memcmp(eeprom_cache_image(), expect, sizeof(expect)) == 0);
+
+	return test_result("eeprom_cache");
+}
@@ -0,0 +1,76 @@
+/*
+ * test_eeprom_cache_budget.c
+ *
+ * Erase budget of the write-back cache (eeprom_cache.c, built with
+ * EEPROM_CACHE_ERASES_PER_HOUR=60): writes within budget are committed at
+ * the next idle call, a write storm costs no more than the burst plus the
+ * budget, and the budget is back after any idle time, including one long
+ * enough to overflow a signed ms count (25 days) after forced flushes took
+ * it negative.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_cache.h"
+#include "test.h"
+
+#define COMMIT_MS (3600000 / EEPROM_CACHE_ERASES_PER_HOUR)
+
+static const uint8_t bank[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static uint32_t commits;
+
+static const uint8_t *bank_source(void) {
+	return FLASH_CONTENTS(bank);
+}
+
+static int32_t bank_commit(uint8_t *data) {
+	commits++;
+	return flash_write_page(bank, data);
+}
+
+int main(void) {
+	uint32_t i, before;
+
+	test_init();
+	flash_format(bank, sizeof(bank));
+	test_ms = 1000;
+	eeprom_cache_init(bank_source, bank_commit);
+
+	// Within budget: committed at the next idle call
+	for (i = 0; i < 3; i++) {
+		test_ms += 2 * COMMIT_MS;
+		eeprom_cache_write(0, i);
+		CHECK(eeprom_cache_idle() == 0);
+		CHECK(commits == i + 1);
+	}
+
+	// Storm: a write a second for 10 minutes
+	before = commits;
+	for (i = 0; i < 600; i++) {
+		test_ms += 1000;
+		eeprom_cache_write(1, i);
+		CHECK(eeprom_cache_idle() == 0);
+	}
+	CHECK(commits - before <= EEPROM_CACHE_ERASE_BURST + 600000 / COMMIT_MS);
+	CHECK(eeprom_cache_stats.throttled > 0);
+	printf("600 writes in 10 minutes: %u commits (budget %u/hour, burst %u)\n",
+			commits - before, EEPROM_CACHE_ERASES_PER_HOUR, EEPROM_CACHE_ERASE_BURST);
+	CHECK(eeprom_cache_flush() == 0);
+	CHECK(memcmp(bank_source(), eeprom_cache_image(), FLASH_PAGE_SIZE) == 0);
+
+	// Forced flushes take the budget negative, then a long idle
+	for (i = 0; i < 5; i++) {
+		eeprom_cache_write(2, i + 1);
+		CHECK(eeprom_cache_flush() == 0);
+	}
+	test_ms += 25u * 24 * 3600 * 1000;
+	before = commits;
+	eeprom_cache_write(2, 0x55);
+	CHECK(eeprom_cache_idle() == 0);
+	CHECK(commits == before + 1);
+	CHECK(bank_source()[2] == 0x55);
+
+	return test_result("eeprom_cache_budget");
+}
@@ -0,0 +1,121 @@
+/*
+ * test_eeprom_log.c
+ *
+ * Log structured bank (eeprom_log.c): random byte writes must read back
+ * the same before and after a remount, and cost fewer erases than
+ * rewriting a page per write. With eeprom_log_idle() called between
+ * writes, no write may make an erase call: the simulator must see every
+ * erase made by eeprom_log_idle(). Reports erases per logical write and
+ * mean write latency (simulated) against the page rewrite.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_log.h"
+#include "test.h"
+
+#define WRITES (2000)
+
+// Page rewritten on every write, as eeprom_write() does without a store
+static const uint8_t plain_page[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static uint8_t expect[EEPROM_LOG_BANK_SIZE];
+
+// Pages erased (by the simulator's count) in writes and in idle calls
+static uint32_t write_erases, idle_erases;
+
+/*
+ * Write the trace to the log, calling eeprom_log_idle() between writes if
+ * idle is set.
+ *
+ * @return Simulated ms spent in writes (not idle erases)
+ */
+static double run_log(int idle) {
+	double write_ms = 0, t;
+	uint32_t erases;
+	int i;
+
+	srand(1);
+	eeprom_log_format();
+	memset(expect, 0, sizeof(expect));
+	memset(&eeprom_log_stats, 0, sizeof(eeprom_log_stats));
+	write_erases = idle_erases = 0;
+
+	for (i = 0; i < WRITES; i++) {
+		uint32_t addr = rand() % EEPROM_LOG_BANK_SIZE;
+		uint8_t val = rand();
+
+		t = test_sim_ms();
+		erases = iap_sim_stats.page_erases;
+		CHECK(eeprom_log_write(addr, val) == 0);
+		write_erases += iap_sim_stats.page_erases - erases;
+		write_ms += test_sim_ms() - t;
+		expect[addr] = val;
+
+		if (idle) {
+			erases = iap_sim_stats.page_erases;
+			CHECK(eeprom_log_idle() == 0);
+			idle_erases += iap_sim_stats.page_erases - erases;
+		}
+		if (i % 97 == 0) {
+			// Contents must be found again at mount
+			CHECK(eeprom_log_mount() == 0);
+		}
+		CHECK(memcmp(eeprom_log_image(), expect, sizeof(expect)) == 0);
+	}
+	return write_ms;
+}
+
+/*
+ * Same trace as one page rewrite per write.
+ *
+ * @return Simulated ms spent in writes
+ */
+static double run_plain(uint32_t *erases) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	uint32_t before = iap_sim_stats.page_erases;
+	double t = test_sim_ms();
+	int i;
+
+	srand(1);
+	flash_format(plain_page, sizeof(plain_page));
+	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < WRITES; i++) {
+		uint32_t addr = rand() % FLASH_PAGE_SIZE;
+		buf[addr] = rand();
+		CHECK(flash_write_page(plain_page, buf) == 0);
+		CHECK(memcmp(FLASH_CONTENTS(plain_page), buf, sizeof(buf)) == 0);
+	}
+	*erases = iap_sim_stats.page_erases - before;
+	return test_sim_ms() - t;
+}
+
+int main(void) {
+	uint32_t erases, writes;
+	double ms;
+
+	test_init();
+
+	ms = run_log(0);
+	writes = eeprom_log_stats.writes;
+	CHECK(eeprom_log_stats.erases < writes / 4);
+	CHECK(write_erases == eeprom_log_stats.erases);
+	printf("log, no idle: %.3f erases/write, %.2f ms/write\n",
+			(double)eeprom_log_stats.erases / writes, ms / writes);
+
+	ms = run_log(1);
+	writes = eeprom_log_stats.writes;
+	CHECK(eeprom_log_stats.foreground_erases == 0);
+	CHECK(write_erases == 0);
+	CHECK(idle_erases > 0 && idle_erases == eeprom_log_stats.erases);
+	printf("log, idle erase: %.3f erases/write, %.2f ms/write\n",
+			(double)eeprom_log_stats.erases / writes, ms / writes);
+
+	ms = run_plain(&erases);
+	printf("page rewrite: %.3f erases/write, %.2f ms/write\n",
+			(double)erases / WRITES, ms / WRITES);
+
+	return test_result("eeprom_log");
+}
@@ -0,0 +1,180 @@
+/*
+ * test_eeprom_txn.c
+ *
+ * Transactions (eeprom_txn.c): staged writes must reach flash only on
+ * commit, all in one bank write, and an abort must leave flash untouched.
+ * Committed to the A/B bank, a power failure at any point of the commit
+ * must leave all of the fields old or all new, where the same changes as
+ * single byte commits can leave a mix. Reports erases, copies and
+ * simulated time of N single byte commits against one N field
+ * transaction.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_ab.h"
+#include "eeprom_txn.h"
+#include "test.h"
+
+// Bank rewritten on every commit, as eeprom_write() does
+static const uint8_t page[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static uint8_t old_image[EEPROM_TXN_SIZE], new_image[EEPROM_TXN_SIZE];
+static uint32_t field_addr[16];
+static uint32_t n_fields;
+
+static int32_t page_commit(uint8_t *image) {
+	return flash_write_page(page, image);
+}
+
+static const uint8_t *page_data(void) {
+	return FLASH_CONTENTS(page);
+}
+
+/*
+ * Choose n fields and new values for them
+ */
+static void choose(uint32_t n) {
+	uint32_t i;
+
+	n_fields = n;
+	memcpy(new_image, old_image, sizeof(new_image));
+	for (i = 0; i < n; i++) {
+		field_addr[i] = i * (EEPROM_TXN_SIZE / n) + rand() % (EEPROM_TXN_SIZE / n);
+		new_image[field_addr[i]] = old_image[field_addr[i]] ^ (1 + rand() % 255);
+	}
+}
+
+/*
+ * Apply the chosen fields as one transaction, or as one single byte
+ * transaction each.
+ */
+static int32_t apply(int single, const uint8_t *(*data)(void), eeprom_txn_commit_fn commit) {
+	uint32_t i;
+	int32_t status = 0;
+
+	if (single) {
+		for (i = 0; i < n_fields && status == 0; i++) {
+			CHECK(eeprom_txn_begin(data()) == 0);
+			CHECK(eeprom_txn_write(field_addr[i], new_image[field_addr[i]]) == 0);
+			status = eeprom_txn_commit(commit);
+		}
+		return status;
+	}
+	CHECK(eeprom_txn_begin(data()) == 0);
+	for (i = 0; i < n_fields; i++) {
+		CHECK(eeprom_txn_write(field_addr[i], new_image[field_addr[i]]) == 0);
+	}
+	return eeprom_txn_commit(commit);
+}
+
+/*
+ * Set the bank (page or A/B) to old_image
+ */
+static void reset_page(void) {
+	CHECK(flash_write_page(page, old_image) == 0);
+}
+
+static void reset_ab(void) {
+	CHECK(eeprom_ab_format() == 0);
+	CHECK(eeprom_ab_commit(old_image) == 0);
+}
+
+/*
+ * Power failure at every erase / copy of applying 8 fields to the A/B
+ * bank.
+ *
+ * @return Number of interruption points that left a mix of old and new
+ * fields
+ */
+static uint32_t mixed_after_failure(int single, uint32_t *points) {
+	uint32_t ops, mixed = 0;
+	int32_t status;
+	int is_old, is_new;
+
+	*points = 0;
+	choose(8);
+	for (ops = 0; ; ops++) {
+		reset_ab();
+		iap_sim_fail_after(ops);
+		status = apply(single, eeprom_ab_data, eeprom_ab_commit);
+		iap_sim_power_on();
+		if (eeprom_txn_is_open()) eeprom_txn_abort();
+
+		CHECK(eeprom_ab_mount() == 0);
+		is_old = memcmp(eeprom_ab_data(), old_image, EEPROM_TXN_SIZE) == 0;
+		is_new = memcmp(eeprom_ab_data(), new_image, EEPROM_TXN_SIZE) == 0;
+		if ( ! is_old && ! is_new) mixed++;
+		if (status == 0) break;
+		(*points)++;
+	}
+	return mixed;
+}
+
+int main(void) {
+	uint32_t n, points, mixed, e, c;
+	double t, single_ms;
+
+	test_init();
+	srand(1);
+	for (n = 0; n < EEPROM_TXN_SIZE; n++) {
+		old_image[n] = rand();
+	}
+
+	// Staged writes don't touch flash; abort drops them
+	flash_format(page, sizeof(page));
+	reset_page();
+	choose(4);
+	c = iap_sim_stats.copies;
+	CHECK(eeprom_txn_begin(page_data()) == 0);
+	CHECK(eeprom_txn_is_open());
+	CHECK(eeprom_txn_begin(page_data()) == -1);
+	CHECK(eeprom_txn_write(field_addr[0], new_image[field_addr[0]]) == 0);
+	CHECK(eeprom_txn_write(EEPROM_TXN_SIZE, 0) == -1);
+	eeprom_txn_abort();
+	CHECK( ! eeprom_txn_is_open());
+	CHECK(eeprom_txn_write(0, 0) == -1);
+	CHECK(eeprom_txn_commit(page_commit) == -1);
+	CHECK(iap_sim_stats.copies == c);
+	CHECK(memcmp(page_data(), old_image, EEPROM_TXN_SIZE) == 0);
+	CHECK(eeprom_txn_stats.aborts == 1);
+
+	// N single byte commits against one N field transaction
+	for (n = 2; n <= 16; n *= 2) {
+		choose(n);
+
+		reset_page();
+		e = iap_sim_stats.page_erases;
+		c = iap_sim_stats.copies;
+		t = test_sim_ms();
+		CHECK(apply(1, page_data, page_commit) == 0);
+		single_ms = test_sim_ms() - t;
+		CHECK(memcmp(page_data(), new_image, EEPROM_TXN_SIZE) == 0);
+		printf("%2u fields: single commits %2u erases %2u copies %7.1f ms,",
+				n, iap_sim_stats.page_erases - e, iap_sim_stats.copies - c, single_ms);
+
+		reset_page();
+		e = iap_sim_stats.page_erases;
+		c = iap_sim_stats.copies;
+		t = test_sim_ms();
+		CHECK(apply(0, page_data, page_commit) == 0);
+		t = test_sim_ms() - t;
+		CHECK(memcmp(page_data(), new_image, EEPROM_TXN_SIZE) == 0);
+		CHECK(iap_sim_stats.page_erases - e <= 1 && iap_sim_stats.copies - c == 1);
+		CHECK(t < single_ms);
+		printf(" transaction %u erase %u copy %6.1f ms\n",
+				iap_sim_stats.page_erases - e, iap_sim_stats.copies - c, t);
+	}
+
+	// Atomicity on the A/B bank
+	mixed = mixed_after_failure(0, &points);
+	CHECK(mixed == 0);
+	printf("transaction: %u interruption points, %u mixed\n", points, mixed);
+	mixed = mixed_after_failure(1, &points);
+	CHECK(mixed > 0);
+	printf("single commits: %u interruption points, %u mixed\n", points, mixed);
+
+	return test_result("eeprom_txn");
+}
@@ -0,0 +1,131 @@
+/*
+ * test_flash_async.c
+ *
+ * Non-blocking page write (flash_async.c) over random rewrites of a few
+ * pages: each flash_async_poll() step must make one prepare and a single
+ * erase or copy, a write must take two steps when the page needs an
+ * erase, one when it can be programmed over and none when it is already
+ * up to date, and the done function must be called once with the page
+ * holding the data. Reports the longest step against the time a blocking
+ * flash_write_page() keeps the main loop waiting.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "flash_async.h"
+#include "test.h"
+
+#define PAGES (4)
+#define WRITES (2000)
+
+static const uint8_t area[PAGES * FLASH_PAGE_SIZE] FLASH_STORAGE
+	= FLASH_ERASED_INIT(PAGES * FLASH_PAGE_SIZE);
+
+#define PAGE_ADDR(i) (FLASH_CONTENTS(area) + (i) * FLASH_PAGE_SIZE)
+
+static uint32_t done_calls;
+static int32_t done_status;
+
+static void done(int32_t status) {
+	done_calls++;
+	done_status = status;
+}
+
+/*
+ * New contents for a page: the same, programmable over the old (bits only
+ * cleared) or needing an erase
+ */
+static void next_data(const uint8_t *old, uint8_t *data) {
+	uint32_t i, r = rand() % 4;
+
+	for (i = 0; i < FLASH_PAGE_SIZE; i++) {
+		if (r == 0) {
+			data[i] = old[i];
+		} else if (r == 1) {
+			data[i] = old[i] & rand();
+		} else {
+			data[i] = rand();
+		}
+	}
+}
+
+int main(void) {
+	uint8_t data[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	struct iap_sim_stats before;
+	uint32_t i, p, steps, erase_steps, paths[3] = {0, 0, 0};
+	double t, blocking_ms = 0, erase_ms, program_ms;
+
+	test_init();
+
+	srand(1);
+	for (i = 0; i < WRITES; i++) {
+		p = rand() % PAGES;
+		next_data(PAGE_ADDR(p), data);
+
+		done_calls = 0;
+		CHECK(flash_async_write_page(PAGE_ADDR(p), data, done) == 0);
+		if ( ! flash_async_busy()) {
+			// Already up to date
+			CHECK(done_calls == 1 && done_status == 0);
+			paths[0]++;
+			continue;
+		}
+		CHECK(done_calls == 0);
+
+		// Data was copied, and only one write at a time
+		memset(data, 0, sizeof(data));
+		CHECK(flash_async_write_page(PAGE_ADDR(p), data, done) == -1);
+		CHECK(flash_async_pending(PAGE_ADDR(p)) != 0);
+		CHECK(flash_async_pending(PAGE_ADDR((p + 1) % PAGES)) == 0);
+		memcpy(data, flash_async_pending(PAGE_ADDR(p)), sizeof(data));
+
+		steps = erase_steps = 0;
+		while (flash_async_busy()) {
+			before = iap_sim_stats;
+			CHECK(flash_async_poll() == 0);
+			steps++;
+
+			// One ROM call (plus its prepare) per step
+			CHECK(iap_sim_stats.prepares - before.prepares == 1);
+			CHECK(iap_sim_stats.sector_erases == before.sector_erases);
+			if (iap_sim_stats.page_erases != before.page_erases) {
+				CHECK(iap_sim_stats.page_erases - before.page_erases == 1);
+				CHECK(iap_sim_stats.copies == before.copies);
+				CHECK(steps == 1);
+				erase_steps++;
+			} else {
+				CHECK(iap_sim_stats.copies - before.copies == 1);
+			}
+			CHECK(done_calls == ! flash_async_busy());
+		}
+		CHECK(steps == 1 + erase_steps);
+		paths[steps]++;
+		CHECK(done_calls == 1 && done_status == 0);
+		CHECK(memcmp(PAGE_ADDR(p), data, sizeof(data)) == 0);
+		CHECK(flash_async_poll() == 0);
+	}
+	CHECK(paths[0] > 0 && paths[1] > 0 && paths[2] > 0);
+
+	// Blocking write of a page needing an erase, for comparison
+	for (i = 0; i < 10; i++) {
+		for (p = 0; p < FLASH_PAGE_SIZE; p++) {
+			data[p] = rand();
+		}
+		t = test_sim_ms();
+		CHECK(flash_write_page(PAGE_ADDR(0), data) == 0);
+		t = test_sim_ms() - t;
+		if (t > blocking_ms) blocking_ms = t;
+	}
+
+	erase_ms = flash_async_stats.step_max[FLASH_ASYNC_ERASE] / (IAP_SIM_TICKS_PER_US * 1000.0);
+	program_ms = flash_async_stats.step_max[FLASH_ASYNC_PROGRAM] / (IAP_SIM_TICKS_PER_US * 1000.0);
+	printf("%u writes: %u up to date, %u program only, %u erase + program\n",
+			flash_async_stats.writes, paths[0], paths[1], paths[2]);
+	printf("longest step: erase %.2f ms, program %.2f ms; blocking write %.2f ms\n",
+			erase_ms, program_ms, blocking_ms);
+	CHECK(erase_ms < blocking_ms && program_ms < blocking_ms);
+
+	return test_result("flash_async");
+}
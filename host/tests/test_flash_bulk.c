@@ -0,0 +1,84 @@
+/*
+ * test_flash_bulk.c
+ *
+ * Bulk write (flash_write_bulk()) against a page by page loop of
+ * flash_write_page() for 256, 512 and 1024 byte regions: contents must
+ * match and the bulk write must use one ranged erase and the largest
+ * copies. Reports IAP calls and simulated time of each.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "test.h"
+
+static const uint8_t region[FLASH_SECTOR_SIZE]
+	FLASH_STORAGE __attribute__ ((aligned (FLASH_SECTOR_SIZE)))
+	= FLASH_ERASED_INIT(FLASH_SECTOR_SIZE);
+
+static uint8_t data[FLASH_SECTOR_SIZE] __attribute__ ((aligned (4)));
+
+struct cost {
+	uint32_t calls;		// prepare, erase and copy calls
+	uint32_t erases;	// ranged erases (flash_erase_pages() calls)
+	uint32_t copies;
+	double ms;
+};
+
+static void fill(uint32_t len) {
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		data[i] = rand();
+	}
+}
+
+/*
+ * Write len bytes of new data over old, by bulk write or page by page
+ */
+static void measure(uint32_t len, int bulk, struct cost *c) {
+	struct iap_sim_stats before;
+	uint32_t offset, erases;
+	double t;
+
+	// Old contents (cost not counted)
+	fill(len);
+	CHECK(flash_write_bulk(region, data, len) == 0);
+
+	fill(len);
+	before = iap_sim_stats;
+	erases = flash_write_stats.erase;
+	t = test_sim_ms();
+	if (bulk) {
+		CHECK(flash_write_bulk(region, data, len) == 0);
+	} else {
+		for (offset = 0; offset < len; offset += FLASH_PAGE_SIZE) {
+			CHECK(flash_write_page(region + offset, data + offset) == 0);
+		}
+	}
+	c->ms = test_sim_ms() - t;
+	c->erases = flash_write_stats.erase - erases;
+	c->copies = iap_sim_stats.copies - before.copies;
+	c->calls = iap_sim_stats.prepares - before.prepares + c->copies + c->erases;
+	CHECK(memcmp(FLASH_CONTENTS(region), data, len) == 0);
+}
+
+int main(void) {
+	struct cost page, bulk;
+	uint32_t len;
+
+	test_init();
+	srand(1);
+
+	for (len = 256; len <= FLASH_SECTOR_SIZE; len *= 2) {
+		measure(len, 0, &page);
+		measure(len, 1, &bulk);
+		CHECK(bulk.copies == 1);
+		CHECK(bulk.erases == 1);
+		CHECK(bulk.ms < page.ms);
+		printf("%4u bytes: page loop %2u calls %7.1f ms, bulk %u calls %6.1f ms\n",
+				len, page.calls, page.ms, bulk.calls, bulk.ms);
+	}
+
+	return test_result("flash_bulk");
+}
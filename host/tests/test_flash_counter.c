@@ -0,0 +1,154 @@
+/*
+ * test_flash_counter.c
+ *
+ * Bit clearing counter (flash_counter.c): the value must step by one on
+ * every increment across page changes, with and without the idle erase,
+ * and a power failure at any point of an increment must leave the old or
+ * the new value. Reports increments per erase, simulated increment time
+ * and read time against a counter rewritten in a page on every increment
+ * (as eeprom_write() would).
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "flash.h"
+#include "flash_counter.h"
+#include "test.h"
+
+// Three page changes and a bit
+#define INCREMENTS (3 * FLASH_COUNTER_BITS + 17)
+
+FLASH_COUNTER(counter);
+
+// Naive counter: a word at the start of a page
+static const uint8_t naive_page[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static int32_t naive_increment(void) {
+	uint32_t buf[FLASH_PAGE_SIZE / 4];
+
+	memcpy(buf, FLASH_CONTENTS(naive_page), sizeof(buf));
+	buf[0]++;
+	return flash_write_page(naive_page, (uint8_t *)buf);
+}
+
+static uint32_t naive_read(void) {
+	return *(const volatile uint32_t *)naive_page;
+}
+
+static double host_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * Increment INCREMENTS times from a blank counter, calling
+ * flash_counter_idle() after each if idle is set.
+ *
+ * @return Page erases made by increments
+ */
+static uint32_t run(int idle) {
+	uint32_t i, erases = 0, before;
+
+	flash_format(counter, FLASH_COUNTER_SIZE);
+	CHECK(flash_counter_read(counter) == 0);
+	for (i = 1; i <= INCREMENTS; i++) {
+		before = iap_sim_stats.page_erases;
+		CHECK(flash_counter_increment(counter) == 0);
+		erases += iap_sim_stats.page_erases - before;
+		CHECK(flash_counter_read(counter) == i);
+		if (idle) CHECK(flash_counter_idle(counter) == 0);
+	}
+	return erases;
+}
+
+/*
+ * Fail the power at every erase / program of the increments around each
+ * page change.
+ *
+ * @return Number of interruption points
+ */
+static uint32_t power_fail(void) {
+	uint32_t i, value, ops, points = 0;
+	int32_t status;
+	int idle;
+
+	for (idle = 0; idle <= 1; idle++) {
+		flash_format(counter, FLASH_COUNTER_SIZE);
+		for (i = 0; i < INCREMENTS; i++) {
+			value = flash_counter_read(counter);
+			if (value % FLASH_COUNTER_BITS < FLASH_COUNTER_BITS - 2 && value > 2) {
+				CHECK(flash_counter_increment(counter) == 0);
+				continue;
+			}
+			for (ops = 0; ; ops++) {
+				iap_sim_fail_after(ops);
+				if (idle) flash_counter_idle(counter);
+				status = flash_counter_increment(counter);
+				iap_sim_power_on();
+				CHECK(flash_counter_read(counter) == value
+						|| flash_counter_read(counter) == value + 1);
+				if (status == 0) break;
+				points++;
+				// The next increment must carry on from what was kept
+				if (flash_counter_read(counter) == value + 1) break;
+			}
+			CHECK(flash_counter_read(counter) == value + 1);
+		}
+	}
+	return points;
+}
+
+int main(void) {
+	uint32_t erases, i, naive_erases, reads = 1000000;
+	double t, ms, naive_ms, read_first_ns, read_last_ns, naive_ns;
+	volatile uint32_t sink = 0;
+
+	test_init();
+
+	erases = run(0);
+	CHECK(erases <= INCREMENTS / FLASH_COUNTER_BITS);
+	printf("no idle: %u increments, %u erases\n", INCREMENTS, erases);
+
+	t = test_sim_ms();
+	erases = run(1);
+	ms = test_sim_ms() - t;
+	CHECK(erases == 0);
+	printf("idle erase: %u increments, %u erases in increments\n", INCREMENTS, erases);
+
+	printf("%u interruption points: old or new value after each\n", power_fail());
+
+	// Read: first bit of a page, and last
+	flash_format(counter, FLASH_COUNTER_SIZE);
+	flash_counter_increment(counter);
+	t = host_ns();
+	for (i = 0; i < reads; i++) sink += flash_counter_read(counter);
+	read_first_ns = (host_ns() - t) / reads;
+	for (i = 1; i < FLASH_COUNTER_BITS; i++) flash_counter_increment(counter);
+	CHECK(flash_counter_read(counter) == FLASH_COUNTER_BITS);
+	t = host_ns();
+	for (i = 0; i < reads; i++) sink += flash_counter_read(counter);
+	read_last_ns = (host_ns() - t) / reads;
+
+	// Naive counter
+	flash_format(naive_page, sizeof(naive_page));
+	flash_write_page(naive_page, (uint8_t[FLASH_PAGE_SIZE]){0});
+	naive_erases = iap_sim_stats.page_erases;
+	t = test_sim_ms();
+	for (i = 0; i < INCREMENTS; i++) CHECK(naive_increment() == 0);
+	naive_ms = test_sim_ms() - t;
+	naive_erases = iap_sim_stats.page_erases - naive_erases;
+	CHECK(naive_read() == INCREMENTS);
+	t = host_ns();
+	for (i = 0; i < reads; i++) sink += naive_read();
+	naive_ns = (host_ns() - t) / reads;
+
+	printf("bit counter: %.0f increments/erase, %.2f ms/increment (with idle erase),"
+			" read %.1f - %.1f ns (host)\n", (double)FLASH_COUNTER_BITS,
+			ms / INCREMENTS, read_first_ns, read_last_ns);
+	printf("page rewrite: %.0f increments/erase, %.2f ms/increment, read %.1f ns (host)\n",
+			(double)INCREMENTS / naive_erases, naive_ms / INCREMENTS, naive_ns);
+
+	return test_result("flash_counter");
+}
@@ -0,0 +1,119 @@
+/*
+ * test_flash_format.c
+ *
+ * Format (flash_format()) of regions with partial sectors at either end,
+ * whole sectors only, part of one sector and across a sector boundary:
+ * the whole sectors must go in one ranged sector erase call and each
+ * partial end in one page range erase call, the region must be blank and
+ * every byte outside it unchanged. Reports simulated time against erasing
+ * the region a page at a time. Built with ENABLE_IAP_STATS for the call
+ * counts.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "iap_stats.h"
+#include "test.h"
+
+#define SECTORS (4)
+#define AREA_SIZE (SECTORS * FLASH_SECTOR_SIZE)
+
+static const uint8_t area[AREA_SIZE]
+	FLASH_STORAGE __attribute__ ((aligned (FLASH_SECTOR_SIZE)))
+	= FLASH_ERASED_INIT(AREA_SIZE);
+
+static uint8_t data[AREA_SIZE] __attribute__ ((aligned (4)));
+
+struct format_case {
+	const char *name;
+	uint32_t start_page;	// in area
+	uint32_t pages;
+	uint32_t page_calls;	// expected erase calls
+	uint32_t sector_calls;
+};
+
+static const struct format_case cases[] = {
+	{"head + 2 sectors + tail", 3, 13 + 32 + 5, 2, 1},
+	{"2 sectors", 16, 32, 0, 1},
+	{"head + 1 sector", 10, 6 + 16, 1, 1},
+	{"within a sector", 2, 9, 1, 0},
+	{"across a boundary", 12, 8, 1, 0},
+	{"whole area", 0, SECTORS * 16, 0, 1},
+};
+
+/*
+ * Fill the whole area with non-blank data (cost not counted)
+ */
+static void fill(void) {
+	uint32_t i;
+	for (i = 0; i < AREA_SIZE; i++) {
+		data[i] = rand() & 0x7F;
+	}
+	CHECK(flash_write_bulk(area, data, AREA_SIZE) == 0);
+}
+
+static int is_blank(const uint8_t *p, uint32_t len) {
+	while (len--) {
+		if (*p++ != FLASH_ERASED_BYTE) return 0;
+	}
+	return 1;
+}
+
+int main(void) {
+	const struct format_case *c;
+	uint32_t i, p, start, len, page_calls, sector_calls;
+	double t, format_ms, loop_ms;
+
+	test_init();
+	srand(1);
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		c = &cases[i];
+		start = c->start_page * FLASH_PAGE_SIZE;
+		len = c->pages * FLASH_PAGE_SIZE;
+
+		fill();
+		page_calls = iap_stats[IAP_OP_ERASE_PAGE].calls;
+		sector_calls = iap_stats[IAP_OP_ERASE_SECTOR].calls;
+		t = test_sim_ms();
+		CHECK(flash_format(area + start, len) == 0);
+		format_ms = test_sim_ms() - t;
+		CHECK(iap_stats[IAP_OP_ERASE_PAGE].calls - page_calls == c->page_calls);
+		CHECK(iap_stats[IAP_OP_ERASE_SECTOR].calls - sector_calls == c->sector_calls);
+
+		CHECK(is_blank(FLASH_CONTENTS(area) + start, len));
+		CHECK(memcmp(FLASH_CONTENTS(area), data, start) == 0);
+		CHECK(memcmp(FLASH_CONTENTS(area) + start + len, data + start + len,
+				AREA_SIZE - start - len) == 0);
+
+		// Nothing to do when already blank
+		page_calls = iap_stats[IAP_OP_ERASE_PAGE].calls;
+		sector_calls = iap_stats[IAP_OP_ERASE_SECTOR].calls;
+		CHECK(flash_format(area + start, len) == 0);
+		CHECK(iap_stats[IAP_OP_ERASE_PAGE].calls == page_calls);
+		CHECK(iap_stats[IAP_OP_ERASE_SECTOR].calls == sector_calls);
+
+		// Page by page
+		fill();
+		t = test_sim_ms();
+		for (p = 0; p < c->pages; p++) {
+			CHECK(flash_erase_pages(FLASH_PAGE_OF(area + start) + p,
+					FLASH_PAGE_OF(area + start) + p) == 0);
+		}
+		loop_ms = test_sim_ms() - t;
+		CHECK(is_blank(FLASH_CONTENTS(area) + start, len));
+		CHECK(format_ms <= loop_ms);
+
+		printf("%-24s %2u pages: format %u page + %u sector calls %7.1f ms,"
+				" page loop %7.1f ms\n", c->name, c->pages, c->page_calls,
+				c->sector_calls, format_ms, loop_ms);
+	}
+
+	// Misaligned
+	CHECK(flash_format(area + 1, FLASH_PAGE_SIZE) == -1);
+	CHECK(flash_format(area, FLASH_PAGE_SIZE + 4) == -1);
+
+	return test_result("flash_format");
+}
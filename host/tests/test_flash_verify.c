@@ -0,0 +1,109 @@
+/*
+ * test_flash_verify.c
+ *
+ * Verify after write (flash_verify()) in each mode: with a byte of
+ * programmed flash changed at the start, middle or end of a word, page or
+ * region, the ROM compare, software and CRC checks must all fail with the
+ * offset of the first changed byte, pass again once it is restored, and
+ * the off mode must not look. Reports the cost of checking a region in
+ * each mode: simulated IAP time (the compare command) and host time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "flash.h"
+#include "test.h"
+
+#define REGION_SIZE (1024)
+#define RUNS (20000)
+
+static const uint8_t region[REGION_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(REGION_SIZE);
+
+static uint8_t data[REGION_SIZE] __attribute__ ((aligned (4)));
+
+static const uint32_t offsets[] = {0, 1, 2, 3, 63, 64, 65, 510, REGION_SIZE - 4, REGION_SIZE - 1};
+
+static const struct {
+	uint32_t mode;
+	const char *name;
+} modes[] = {
+	{FLASH_VERIFY_ROM, "ROM compare"},
+	{FLASH_VERIFY_SOFTWARE, "software"},
+	{FLASH_VERIFY_CRC, "CRC"},
+};
+
+static double host_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * Flash is host memory in the simulator, so a programmed byte can be
+ * changed behind the storage code's back
+ */
+static void corrupt(uint32_t offset, uint8_t bits) {
+	((uint8_t *)FLASH_CONTENTS(region))[offset] ^= bits;
+}
+
+int main(void) {
+	uint32_t i, m, offset, failures;
+	double t, sim_ms;
+
+	test_init();
+	srand(1);
+	for (i = 0; i < REGION_SIZE; i++) {
+		data[i] = rand();
+	}
+	flash_verify_mode = FLASH_VERIFY_OFF;
+	CHECK(flash_write_bulk(region, data, REGION_SIZE) == 0);
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		flash_verify_mode = modes[m].mode;
+		CHECK(flash_verify(region, data, REGION_SIZE, &offset) == 0);
+
+		for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+			failures = flash_verify_stats.failures;
+			offset = 0xFFFFFFFF;
+			corrupt(offsets[i], 1 << (i % 8));
+			CHECK(flash_verify(region, data, REGION_SIZE, &offset) == -8);
+			CHECK(offset == offsets[i]);
+			CHECK(flash_verify_stats.last_offset == offsets[i]);
+			CHECK(flash_verify_stats.failures == failures + 1);
+
+			// First of two
+			corrupt(REGION_SIZE - 1 - offsets[i], 0x80);
+			if (offsets[i] < REGION_SIZE / 2) {
+				CHECK(flash_verify(region, data, REGION_SIZE, &offset) == -8);
+				CHECK(offset == offsets[i]);
+			}
+			corrupt(REGION_SIZE - 1 - offsets[i], 0x80);
+
+			corrupt(offsets[i], 1 << (i % 8));
+			CHECK(flash_verify(region, data, REGION_SIZE, 0) == 0);
+		}
+	}
+
+	// Off: not checked
+	flash_verify_mode = FLASH_VERIFY_OFF;
+	corrupt(100, 0x01);
+	CHECK(flash_verify(region, data, REGION_SIZE, &offset) == 0);
+	corrupt(100, 0x01);
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		flash_verify_mode = modes[m].mode;
+		sim_ms = test_sim_ms();
+		t = host_ns();
+		for (i = 0; i < RUNS; i++) {
+			CHECK(flash_verify(region, data, REGION_SIZE, 0) == 0);
+		}
+		t = (host_ns() - t) / RUNS;
+		sim_ms = (test_sim_ms() - sim_ms) / RUNS;
+		printf("%-12s %u bytes: %.3f ms IAP (simulated), %.0f ns (host)\n",
+				modes[m].name, REGION_SIZE, sim_ms, t);
+	}
+
+	return test_result("flash_verify");
+}
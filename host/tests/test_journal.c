@@ -0,0 +1,131 @@
+/*
+ * test_journal.c
+ *
+ * Event journal (journal.c): after every append the newest records must
+ * come back in order, and a remount must find the same head and count,
+ * through many wraps of the region and of the 16 bit sequence number, with
+ * and without the idle erase. A power failure at any erase / program of
+ * an append must leave the journal with or without the new record. Reports
+ * mount time.
+ */
+
+#include <time.h>
+
+#include "flash.h"
+#include "journal.h"
+#include "test.h"
+
+#define TOTAL_SLOTS (JOURNAL_PAGES * JOURNAL_SLOTS)
+
+// Past a wrap of the sequence number
+#define APPENDS (70000)
+
+static uint32_t appended;
+
+/*
+ * Newest records must be the last appended, newest first
+ */
+static void check_records(void) {
+	const struct journal_record *r;
+	uint32_t n, count = journal_count();
+
+	CHECK(count <= TOTAL_SLOTS && count <= appended);
+	CHECK(count >= TOTAL_SLOTS - JOURNAL_SLOTS || count == appended);
+	for (n = 0; n < count; n++) {
+		r = journal_get(n);
+		CHECK(r != 0 && r->seq == (uint16_t)(appended - 1 - n)
+				&& r->ms == appended - 1 - n
+				&& r->type == JOURNAL_BOOT + (appended - 1 - n) % 4
+				&& r->arg == (uint8_t)(appended - 1 - n));
+	}
+	CHECK(journal_get(count) == 0);
+}
+
+static int32_t append(void) {
+	test_ms = appended;
+	return journal_append(JOURNAL_BOOT + appended % 4, appended);
+}
+
+static void run(int idle) {
+	uint32_t count, foreground = 0, before, end = appended + APPENDS;
+
+	if (idle) CHECK(journal_idle() == 0);
+	while (appended < end) {
+		before = iap_sim_stats.page_erases;
+		CHECK(append() == 0);
+		foreground += iap_sim_stats.page_erases - before;
+		appended++;
+		if (idle) CHECK(journal_idle() == 0);
+		if (appended % 97 == 0 || appended < 2 * TOTAL_SLOTS) {
+			check_records();
+			count = journal_count();
+			CHECK(journal_mount() == 0);
+			CHECK(journal_count() == count);
+			check_records();
+		}
+	}
+	if (idle) {
+		CHECK(foreground == 0);
+	}
+	printf("%s: %u appends, %u erases in appends\n", idle ? "idle erase" : "no idle",
+			APPENDS, foreground);
+}
+
+/*
+ * Power failure at every erase / program of the appends over two wraps
+ * of the region.
+ *
+ * @return Number of interruption points
+ */
+static uint32_t power_fail(void) {
+	uint32_t i, ops, points = 0;
+	int32_t status;
+
+	for (i = 0; i < 2 * TOTAL_SLOTS; i++) {
+		for (ops = 0; ; ops++) {
+			iap_sim_fail_after(ops);
+			status = append();
+			iap_sim_power_on();
+			if (status != 0) points++;
+
+			// Reboot
+			CHECK(journal_mount() == 0);
+			if (journal_count() > 0 && journal_get(0)->seq == (uint16_t)appended) {
+				appended++;
+				check_records();
+				break;
+			}
+			CHECK(status != 0);
+			check_records();
+		}
+	}
+	return points;
+}
+
+int main(void) {
+	struct timespec t0, t1;
+	uint32_t i;
+
+	test_init();
+
+	CHECK(journal_mount() == 0);
+	CHECK(journal_count() == 0 && journal_get(0) == 0);
+
+	run(0);
+	run(1);
+
+	printf("%u interruption points: with or without the new record after each\n",
+			power_fail());
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < 100000; i++) {
+		journal_mount();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	check_records();
+	printf("mount: %.0f ns (host), %u slots\n",
+			((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 100000,
+			(unsigned)TOTAL_SLOTS);
+
+	return test_result("journal");
+}
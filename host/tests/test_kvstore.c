@@ -0,0 +1,108 @@
+/*
+ * test_kvstore.c
+ *
+ * Key/value store (kvstore.c): random sets and deletes of variable length
+ * values must match a model before and after a remount, through many
+ * page rotations. Reports get / set throughput and SRAM index size.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kvstore.h"
+#include "test.h"
+
+#define OPS (5000)
+
+// Model: value and length of each key (-1 if not set)
+static uint8_t model[KVSTORE_MAX_KEYS][KVSTORE_MAX_VALUE];
+static int model_len[KVSTORE_MAX_KEYS];
+
+static void check_all(void) {
+	uint32_t key, len;
+	const uint8_t *v;
+
+	for (key = 0; key < KVSTORE_MAX_KEYS; key++) {
+		v = kvstore_get(key, &len);
+		if (model_len[key] < 0) {
+			CHECK(v == 0);
+		} else {
+			CHECK(v != 0 && len == (uint32_t)model_len[key]
+					&& memcmp(v, model[key], len) == 0);
+		}
+	}
+}
+
+static double host_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int main(void) {
+	uint8_t value[KVSTORE_MAX_VALUE];
+	uint32_t i, j, key, len, sets = 0;
+	double t, set_ms = 0, get_ns;
+	volatile uint32_t sink = 0;
+
+	test_init();
+	srand(1);
+	CHECK(kvstore_format() == 0);
+	for (key = 0; key < KVSTORE_MAX_KEYS; key++) {
+		model_len[key] = -1;
+	}
+
+	// Few hot keys with short values, so pages rotate many times
+	for (i = 0; i < OPS; i++) {
+		key = rand() % 8;
+		if (rand() % 10 == 0) {
+			CHECK(kvstore_delete(key) == 0);
+			model_len[key] = -1;
+		} else {
+			len = 1 + rand() % 11;
+			for (j = 0; j < len; j++) {
+				value[j] = rand();
+			}
+			t = test_sim_ms();
+			CHECK(kvstore_set(key, value, len) == 0);
+			set_ms += test_sim_ms() - t;
+			sets++;
+			memcpy(model[key], value, len);
+			model_len[key] = len;
+		}
+		if (i % 53 == 0) {
+			// Zero length set deletes
+			CHECK(kvstore_set(key, value, 0) == 0);
+			model_len[key] = -1;
+		}
+		if (i % 101 == 0) {
+			CHECK(kvstore_mount() == 0);
+			check_all();
+		}
+	}
+	CHECK(kvstore_mount() == 0);
+	check_all();
+
+	// Largest value
+	memset(value, 0x5A, sizeof(value));
+	CHECK(kvstore_set(20, value, KVSTORE_MAX_VALUE) == 0);
+	memcpy(model[20], value, KVSTORE_MAX_VALUE);
+	model_len[20] = KVSTORE_MAX_VALUE;
+	CHECK(kvstore_set(21, value, KVSTORE_MAX_VALUE + 1) != 0);
+	CHECK(kvstore_mount() == 0);
+	check_all();
+
+	t = host_ns();
+	for (i = 0; i < 1000000; i++) {
+		if (kvstore_get(i % KVSTORE_MAX_KEYS, &len)) sink += len;
+	}
+	get_ns = (host_ns() - t) / 1000000;
+
+	printf("set: %.2f ms simulated (mean of %u, including rotations)\n", set_ms / sets, sets);
+	printf("get: %.1f ns (host), no flash walk\n", get_ns);
+	printf("index: %u bytes SRAM for %u keys (2 bytes/key)\n",
+			(unsigned)(KVSTORE_MAX_KEYS * sizeof(uint16_t)), KVSTORE_MAX_KEYS);
+
+	return test_result("kvstore");
+}
@@ -0,0 +1,215 @@
+/*
+ * test_settings.c
+ *
+ * Typed settings over the bank (settings.c, write cache as stage and
+ * source): defaults on a blank bank, a round trip through the accessors
+ * and by name of every schema type at the ends of its range, with no other
+ * field changed, before and after a flush, and the reset to defaults of a
+ * bank of another schema version. Reports host time of a field get / set
+ * against copying the whole bank to SRAM (memcpy(rambuf, bank, 64)), and
+ * the flash cost of field sets against writing the copy back each time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "flash.h"
+#include "eeprom_cache.h"
+#include "settings.h"
+#include "test.h"
+
+#define RUNS (1000000)
+#define CHANGES (300)
+
+#define DEFAULT_INIT(type, name, def) .name = def,
+
+static const struct settings defaults = {
+	SETTINGS_FIELDS(DEFAULT_INIT)
+};
+
+static const uint8_t bank[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+// Bank written whole, for the copy pattern
+static const uint8_t copy_bank[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static struct settings model;
+
+static const uint8_t *bank_source(void) {
+	return FLASH_CONTENTS(bank);
+}
+
+static int32_t bank_commit(uint8_t *data) {
+	return flash_write_page(bank, data);
+}
+
+static int32_t stage_byte(uint32_t addr, uint8_t val) {
+	eeprom_cache_write(addr, val);
+	return 0;
+}
+
+static double host_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+ * Every field through its accessor, and the bank bytes, against the model
+ */
+static void check_fields(void) {
+	struct settings s;
+
+#define GET(type, name, def) s.name = settings_get_##name();
+	SETTINGS_FIELDS(GET)
+	CHECK(memcmp(&s, &model, sizeof(s)) == 0);
+	CHECK(memcmp(eeprom_cache_image(), &model, SETTINGS_SIZE) == 0);
+}
+
+/*
+ * Flush and attach again, so that the fields are read from flash
+ */
+static void reload(void) {
+	CHECK(eeprom_cache_flush() == 0);
+	CHECK(memcmp(FLASH_CONTENTS(bank), &model, SETTINGS_SIZE) == 0);
+	eeprom_cache_init(bank_source, bank_commit);
+	CHECK(settings_init(eeprom_cache_image, stage_byte) == 0);
+	check_fields();
+}
+
+static void round_trip(void) {
+	const struct settings_field *f;
+
+	// Through the accessors, at the ends of each type's range
+	CHECK(settings_set_node_id(0xA5) == 0);
+	CHECK(settings_set_baud_rate(0xDEADBEEF) == 0);
+	CHECK(settings_set_sample_ms(0xFFFE) == 0);
+	CHECK(settings_set_cal_offset(-32768) == 0);
+	CHECK(settings_set_cal_gain(0x0001) == 0);
+	CHECK(settings_set_flags(0xFF) == 0);
+	model.node_id = 0xA5;
+	model.baud_rate = 0xDEADBEEF;
+	model.sample_ms = 0xFFFE;
+	model.cal_offset = -32768;
+	model.cal_gain = 0x0001;
+	model.flags = 0xFF;
+	check_fields();
+	reload();
+
+	CHECK(settings_set_baud_rate(0) == 0);
+	CHECK(settings_set_cal_offset(32767) == 0);
+	CHECK(settings_set_flags(0) == 0);
+	model.baud_rate = 0;
+	model.cal_offset = 32767;
+	model.flags = 0;
+	check_fields();
+	reload();
+
+	// By name (values not sign extended)
+	CHECK(settings_find("no_such_field") == 0);
+	CHECK((f = settings_find("cal_offset")) != 0);
+	CHECK(settings_set_field(f, 0xFFFF) == 0);
+	model.cal_offset = -1;
+	CHECK(settings_get_field(f) == 0xFFFF);
+	CHECK((f = settings_find("baud_rate")) != 0);
+	CHECK(settings_set_field(f, 115200) == 0);
+	model.baud_rate = 115200;
+	CHECK(settings_get_field(f) == 115200);
+	CHECK((f = settings_find("node_id")) != 0);
+	CHECK(settings_set_field(f, 0x1234) == 0);
+	model.node_id = 0x34;
+	CHECK(settings_get_field(f) == 0x34);
+	check_fields();
+	reload();
+}
+
+static void benchmark(void) {
+	uint8_t rambuf[SETTINGS_BANK_SIZE] __attribute__ ((aligned (4)));
+	volatile uint32_t sink = 0;
+	uint32_t i, erases, programs;
+	uint16_t v;
+	double t, field_ns, copy_ns;
+
+	// Get
+	t = host_ns();
+	for (i = 0; i < RUNS; i++) {
+		sink += settings_get_sample_ms();
+	}
+	field_ns = (host_ns() - t) / RUNS;
+	t = host_ns();
+	for (i = 0; i < RUNS; i++) {
+		memcpy(rambuf, FLASH_CONTENTS(bank), sizeof(rambuf));
+		memcpy(&v, rambuf + SETTINGS_OFFSET(sample_ms), sizeof(v));
+		sink += v;
+	}
+	copy_ns = (host_ns() - t) / RUNS;
+	printf("get u16: field %.1f ns, copy bank %.1f ns (host)\n", field_ns, copy_ns);
+
+	// Set, counting only the staging / modify
+	t = host_ns();
+	for (i = 0; i < RUNS; i++) {
+		settings_set_sample_ms(i);
+	}
+	field_ns = (host_ns() - t) / RUNS;
+	t = host_ns();
+	for (i = 0; i < RUNS; i++) {
+		memcpy(rambuf, FLASH_CONTENTS(bank), sizeof(rambuf));
+		v = i;
+		memcpy(rambuf + SETTINGS_OFFSET(sample_ms), &v, sizeof(v));
+		sink += rambuf[i & (sizeof(rambuf) - 1)];
+	}
+	copy_ns = (host_ns() - t) / RUNS;
+	printf("set u16: field %.1f ns, copy bank %.1f ns (host)\n", field_ns, copy_ns);
+	CHECK(eeprom_cache_flush() == 0);
+
+	// Flash cost
+	erases = iap_sim_stats.page_erases;
+	programs = iap_sim_stats.copies;
+	for (i = 0; i < CHANGES; i++) {
+		CHECK(settings_set_sample_ms(100 + i) == 0);
+	}
+	CHECK(eeprom_cache_flush() == 0);
+	CHECK(settings_get_sample_ms() == 100 + CHANGES - 1);
+	printf("%u field sets + flush: %u erases, %u programs\n", CHANGES,
+			iap_sim_stats.page_erases - erases, iap_sim_stats.copies - programs);
+
+	erases = iap_sim_stats.page_erases;
+	programs = iap_sim_stats.copies;
+	for (i = 0; i < CHANGES; i++) {
+		memcpy(rambuf, FLASH_CONTENTS(copy_bank), sizeof(rambuf));
+		v = 100 + i;
+		memcpy(rambuf + SETTINGS_OFFSET(sample_ms), &v, sizeof(v));
+		CHECK(flash_write_page(copy_bank, rambuf) == 0);
+	}
+	printf("%u bank writes:        %u erases, %u programs\n", CHANGES,
+			iap_sim_stats.page_erases - erases, iap_sim_stats.copies - programs);
+}
+
+int main(void) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+
+	test_init();
+
+	// Blank bank: defaults applied
+	eeprom_cache_init(bank_source, bank_commit);
+	CHECK(settings_init(eeprom_cache_image, stage_byte) == 1);
+	model = defaults;
+	check_fields();
+	reload();
+
+	round_trip();
+
+	// Another schema version: every field back to its default
+	memset(buf, 0x5A, sizeof(buf));
+	buf[SETTINGS_OFFSET(version)] = SETTINGS_VERSION + 1;
+	CHECK(flash_write_page(bank, buf) == 0);
+	eeprom_cache_init(bank_source, bank_commit);
+	CHECK(settings_init(eeprom_cache_image, stage_byte) == 1);
+	model = defaults;
+	check_fields();
+	reload();
+
+	benchmark();
+
+	return test_result("settings");
+}
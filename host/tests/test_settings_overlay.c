@@ -0,0 +1,164 @@
+/*
+ * test_settings_overlay.c
+ *
+ * Settings in SETTINGS_OVERLAY mode (settings.c over kvstore.c): over a
+ * trace of field changes, some back to the default, every field must read
+ * as a model before and after a remount, a field at its default must have
+ * no record, and records of another schema version must be dropped.
+ * Reports erases and simulated flash time per change against rewriting
+ * the whole settings image in a page on every change. Both program about
+ * a page per change (bytes programmed are shown for that), so the saving
+ * is in erases and the time they take.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "kvstore.h"
+#include "settings.h"
+#include "test.h"
+
+#define CHANGES (2000)
+
+#define DEFAULT_INIT(type, name, def) .name = def,
+
+static const struct settings defaults = {
+	SETTINGS_FIELDS(DEFAULT_INIT)
+};
+
+// Whole image rewritten on every change, as the bank is without overlay
+static const uint8_t image_page[FLASH_PAGE_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_PAGE_SIZE);
+
+static struct settings model;
+
+struct cost {
+	uint32_t bytes;
+	uint32_t erases;
+	double ms;
+};
+
+static void check_fields(void) {
+	struct settings s;
+	uint32_t id;
+
+#define GET(type, name, def) s.name = settings_get_##name();
+	SETTINGS_FIELDS(GET)
+	CHECK(memcmp(&s, &model, sizeof(s)) == 0);
+
+	for (id = 0; id < SETTINGS_FIELD_COUNT; id++) {
+		uint32_t len, offset = settings_fields[id].offset;
+		int is_default = memcmp((uint8_t *)&model + offset, (uint8_t *)&defaults + offset,
+				settings_fields[id].size) == 0;
+		if (id != SETTINGS_FIELD_version) {
+			CHECK(is_default == (kvstore_get(SETTINGS_KEY_BASE + id, &len) == 0));
+		}
+	}
+}
+
+/*
+ * Change the model as a typical node would: mostly calibration, some
+ * fields back to their default.
+ *
+ * @return Field changed
+ */
+static uint32_t change(void) {
+	int r = rand() % 10, to_default = rand() % 4 == 0;
+
+	if (r < 4) {
+		model.cal_offset = to_default ? defaults.cal_offset : rand() % 200 - 100;
+		return SETTINGS_FIELD_cal_offset;
+	} else if (r < 6) {
+		model.cal_gain = to_default ? defaults.cal_gain : 0xF0 + rand() % 0x20;
+		return SETTINGS_FIELD_cal_gain;
+	} else if (r < 8) {
+		model.sample_ms = to_default ? defaults.sample_ms : 100 * (1 + rand() % 50);
+		return SETTINGS_FIELD_sample_ms;
+	} else if (r < 9) {
+		model.node_id = to_default ? defaults.node_id : rand();
+		return SETTINGS_FIELD_node_id;
+	}
+	model.flags = to_default ? defaults.flags : rand();
+	return SETTINGS_FIELD_flags;
+}
+
+static void start(struct cost *c) {
+	c->bytes = iap_sim_stats.bytes_programmed;
+	c->erases = iap_sim_stats.page_erases;
+	c->ms = test_sim_ms();
+}
+
+static void stop(struct cost *c) {
+	c->bytes = iap_sim_stats.bytes_programmed - c->bytes;
+	c->erases = iap_sim_stats.page_erases - c->erases;
+	c->ms = test_sim_ms() - c->ms;
+}
+
+int main(void) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	struct cost overlay, image;
+	uint8_t version = SETTINGS_VERSION + 1;
+	uint32_t i, id, len;
+
+	test_init();
+	CHECK(kvstore_format() == 0);
+
+	// Factory settings: nothing stored
+	CHECK(settings_init(0, 0) == 0);
+	model = defaults;
+	check_fields();
+	for (i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+		CHECK(kvstore_get(SETTINGS_KEY_BASE + i, &len) == 0);
+	}
+
+	srand(1);
+	start(&overlay);
+	for (i = 0; i < CHANGES; i++) {
+		id = change();
+		CHECK(settings_write(id, (uint8_t *)&model + settings_fields[id].offset) == 0);
+		check_fields();
+		if (i % 37 == 0) {
+			CHECK(kvstore_mount() == 0);
+			CHECK(settings_init(0, 0) == 0);
+			check_fields();
+		}
+	}
+	stop(&overlay);
+
+	// Same trace as whole image rewrites
+	srand(1);
+	model = defaults;
+	flash_format(image_page, sizeof(image_page));
+	start(&image);
+	for (i = 0; i < CHANGES; i++) {
+		change();
+		memset(buf, FLASH_ERASED_BYTE, sizeof(buf));
+		memcpy(buf, &model, sizeof(model));
+		CHECK(flash_write_page(image_page, buf) == 0);
+	}
+	stop(&image);
+	CHECK(memcmp(FLASH_CONTENTS(image_page), &model, sizeof(model)) == 0);
+
+	CHECK(overlay.erases < image.erases);
+	CHECK(overlay.ms < image.ms);
+	printf("erases per change: overlay %.3f, image rewrite %.3f (%.1fx fewer)\n",
+			(double)overlay.erases / CHANGES, (double)image.erases / CHANGES,
+			(double)image.erases / overlay.erases);
+	printf("flash time per change: overlay %.2f ms, image rewrite %.2f ms\n",
+			overlay.ms / CHANGES, image.ms / CHANGES);
+	printf("bytes programmed per change (not the saving): overlay %.1f,"
+			" image rewrite %.1f\n", (double)overlay.bytes / CHANGES,
+			(double)image.bytes / CHANGES);
+
+	// Records of another schema version are dropped at start up
+	CHECK(kvstore_set(SETTINGS_KEY_BASE + SETTINGS_FIELD_version, &version, 1) == 0);
+	CHECK(kvstore_mount() == 0);
+	CHECK(settings_init(0, 0) == 1);
+	model = defaults;
+	check_fields();
+	for (i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+		CHECK(kvstore_get(SETTINGS_KEY_BASE + i, &len) == 0);
+	}
+
+	return test_result("settings_overlay");
+}
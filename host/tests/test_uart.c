@@ -0,0 +1,258 @@
+/*
+ * test_uart.c
+ *
+ * Interrupt driven UART (../src/uart.c) against a cycle counted model of
+ * the USART (tests/uart/LPC8xx.h): holding register, shift register and
+ * TXRDY / RXRDY interrupts at 9600 baud on a 12MHz core. Transmitted bytes
+ * must reach the wire in order, echo and received lines must survive, and
+ * the caller must be blocked for much less time than by busy-waiting on
+ * TXRDY. uart_drain() is not covered: it spins without letting the model
+ * run.
+ */
+
+#include <string.h>
+
+#include "LPC8xx.h"
+#include "uart.h"
+#include "test.h"
+
+#define CORE_HZ (12000000)
+#define BAUD (9600)
+
+// Start, 8 data and stop bits
+#define CHAR_CYCLES (CORE_HZ / BAUD * 10)
+
+// CPU cycles per pass of a polling loop and per interrupt (entry, handler
+// and exit)
+#define LOOP_CYCLES (10)
+#define IRQ_CYCLES (40)
+
+// TXDATA value when the holding register is empty
+#define TX_EMPTY (0x100)
+
+LPC_SYSCON_TypeDef uart_model_syscon;
+LPC_USART_TypeDef uart_model_usart;
+uint32_t SystemCoreClock = CORE_HZ;
+uint64_t uart_model_cycles;
+
+static int irq_enabled = 1;
+static uint32_t inten;
+static uint32_t shift_left;		// cycles until shift register is empty
+static int rx_full;
+static const char *rx_input;	// bytes still to arrive
+static uint64_t rx_next;		// cycle of next arrival
+static uint64_t irq_cycles;		// cycles spent in the interrupt handler
+static uint32_t irqs;
+
+static char wire[512];
+static uint32_t wire_len;
+static uint64_t wire_done;		// cycle the last stop bit went out
+
+static void update_stat(void) {
+	uint32_t stat = 0;
+
+	if (uart_model_usart.TXDATA == TX_EMPTY) {
+		stat |= UART_STAT_TXRDY;
+		if (shift_left == 0) stat |= UART_STAT_TXIDLE;
+	}
+	if (rx_full) stat |= UART_STAT_RXRDY;
+	uart_model_usart.STAT = stat;
+}
+
+/*
+ * Move the USART on by one cycle, then take the interrupt if one is
+ * pending and enabled.
+ */
+static void tick(void) {
+	uint32_t stat;
+
+	uart_model_cycles++;
+
+	inten = (inten | uart_model_usart.INTENSET) & ~uart_model_usart.INTENCLR;
+	uart_model_usart.INTENSET = 0;
+	uart_model_usart.INTENCLR = 0;
+
+	if (shift_left && --shift_left == 0) {
+		wire_done = uart_model_cycles;
+	}
+	if (uart_model_usart.TXDATA != TX_EMPTY && shift_left == 0) {
+		wire[wire_len++ % sizeof(wire)] = uart_model_usart.TXDATA;
+		uart_model_usart.TXDATA = TX_EMPTY;
+		shift_left = CHAR_CYCLES;
+	}
+	if (rx_input && *rx_input && ! rx_full && uart_model_cycles >= rx_next) {
+		uart_model_usart.RXDATA = *rx_input++;
+		rx_full = 1;
+		rx_next = uart_model_cycles + CHAR_CYCLES;
+	}
+	update_stat();
+
+	stat = uart_model_usart.STAT;
+	if (irq_enabled && (stat & inten & (UART_STAT_TXRDY | UART_STAT_RXRDY))) {
+		irq_enabled = 0;
+		UART0_IRQHandler();
+		irq_enabled = 1;
+		if (stat & UART_STAT_RXRDY) {
+			rx_full = 0;	// RXDATA was read
+		}
+		inten = (inten | uart_model_usart.INTENSET) & ~uart_model_usart.INTENCLR;
+		uart_model_usart.INTENSET = 0;
+		uart_model_usart.INTENCLR = 0;
+		uart_model_cycles += IRQ_CYCLES;
+		irq_cycles += IRQ_CYCLES;
+		irqs++;
+		update_stat();
+	}
+}
+
+static void run(uint32_t cycles) {
+	while (cycles--) tick();
+}
+
+void __disable_irq(void) {
+	irq_enabled = 0;
+}
+
+void __enable_irq(void) {
+	irq_enabled = 1;
+	run(LOOP_CYCLES);
+}
+
+/*
+ * Sleep until an interrupt has been taken
+ */
+void __WFI(void) {
+	uint32_t n = irqs, cycles = 0;
+
+	while (irqs == n && cycles++ < 10 * CHAR_CYCLES) {
+		tick();
+	}
+}
+
+/*
+ * Run until the ring is empty and the last byte is out
+ */
+static void run_until_idle(void) {
+	uint32_t cycles = 0;
+
+	do {
+		tick();
+	} while (( ! (uart_model_usart.STAT & UART_STAT_TXIDLE) || (inten & UART_STAT_TXRDY))
+			&& cycles++ < 1000 * CHAR_CYCLES);
+}
+
+/*
+ * Transmit as the driver did before the ring buffer: wait for TXRDY before
+ * each byte.
+ */
+static void busy_send_string(const char *s) {
+	while (*s) {
+		while ( ! (uart_model_usart.STAT & UART_STAT_TXRDY)) {
+			run(LOOP_CYCLES);
+		}
+		uart_model_usart.TXDATA = *s++;
+		run(LOOP_CYCLES);
+	}
+}
+
+struct cost {
+	uint64_t blocked;	// cycles until the send call returns
+	uint64_t irq;		// cycles in the interrupt handler
+	uint64_t wire;		// cycles until the last byte is out
+};
+
+static void measure(char *msg, int busy, struct cost *c) {
+	uint64_t t0, irq0;
+
+	run_until_idle();
+	wire_len = 0;
+	t0 = uart_model_cycles;
+	irq0 = irq_cycles;
+	if (busy) {
+		busy_send_string(msg);
+	} else {
+		uart_send_string_z(msg);
+	}
+	c->blocked = uart_model_cycles - t0;
+	run_until_idle();
+	c->wire = wire_done - t0;
+	c->irq = irq_cycles - irq0;
+	CHECK(wire_len == strlen(msg) && memcmp(wire, msg, wire_len) == 0);
+}
+
+static double ms(uint64_t cycles) {
+	return cycles * 1000.0 / CORE_HZ;
+}
+
+static uint32_t hooked;
+
+static int hash_hook(uint8_t c) {
+	if (c == '#') {
+		hooked++;
+		return 1;
+	}
+	return 0;
+}
+
+int main(void) {
+	static char msg[256];
+	static const uint32_t lengths[] = {16, 48, 200};
+	struct cost busy, ring;
+	uint32_t i, n, len;
+	char *line;
+
+	uart_model_usart.TXDATA = TX_EMPTY;
+	update_stat();
+	uart_init(BAUD);
+	CHECK(uart_model_usart.BRG == CORE_HZ / 16 / BAUD - 1);
+
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		len = lengths[i];
+		for (n = 0; n < len; n++) {
+			msg[n] = 'a' + n % 26;
+		}
+		msg[len] = 0;
+
+		measure(msg, 0, &ring);
+
+		// Busy-wait needs the TXRDY interrupt off
+		uart_model_usart.INTENCLR = UART_STAT_TXRDY;
+		measure(msg, 1, &busy);
+
+		if (len < UART_TXBUF_SIZE) {
+			CHECK(ring.blocked < CHAR_CYCLES);
+		}
+		CHECK(ring.blocked + ring.irq < busy.blocked);
+		CHECK(ring.wire <= busy.wire + CHAR_CYCLES);
+		printf("%3u bytes: busy-wait blocked %6.2f ms, ring blocked %6.2f ms"
+				" + %.2f ms in IRQ, on the wire %.1f / %.1f ms\n",
+				len, ms(busy.blocked), ms(ring.blocked), ms(ring.irq),
+				ms(busy.wire), ms(ring.wire));
+	}
+
+	// Received lines, with echo
+	run_until_idle();
+	wire_len = 0;
+	rx_input = "AB\rCD\r";
+	rx_next = uart_model_cycles;
+	line = uart_read_line(&len);
+	CHECK(len == 2 && strcmp(line, "AB") == 0);
+	line = uart_read_line(&len);
+	CHECK(len == 2 && strcmp(line, "CD") == 0);
+	run_until_idle();
+	CHECK(wire_len == 8 && memcmp(wire, "AB\r\nCD\r\n", 8) == 0);
+
+	// Bytes consumed by the receive hook are not echoed or added to the line
+	uart_set_rx_hook(hash_hook);
+	wire_len = 0;
+	rx_input = "x#y\r";
+	rx_next = uart_model_cycles;
+	line = uart_read_line(&len);
+	CHECK(len == 2 && strcmp(line, "xy") == 0);
+	CHECK(hooked == 1);
+	run_until_idle();
+	CHECK(wire_len == 4 && memcmp(wire, "xy\r\n", 4) == 0);
+	CHECK(uart_rx_stats.overrun == 0 && uart_rx_stats.dropped == 0);
+
+	return test_result("uart");
+}
@@ -0,0 +1,137 @@
+/*
+ * test_wear.c
+ *
+ * Persistent erase counters (wear.c, counting through the flash erase
+ * hook): after random single and ranged page erases the count of every
+ * tracked page matches the simulator's own per-page count, and the counts,
+ * total and most worn page are the same after wear_mount() reloads them
+ * from flash, including straight after each compaction into the other
+ * bank. Erases of pages past the WEAR_MAX_PAGES tracked are counted as
+ * untracked. Reports the erases of the counters themselves per erase
+ * counted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash.h"
+#include "wear.h"
+#include "test.h"
+
+#define PAGES (WEAR_MAX_PAGES + 5)
+
+static const uint8_t area[PAGES * FLASH_PAGE_SIZE] FLASH_STORAGE
+	= FLASH_ERASED_INIT(PAGES * FLASH_PAGE_SIZE);
+
+#define PAGE_ADDR(i) (FLASH_CONTENTS(area) + (i) * FLASH_PAGE_SIZE)
+
+static uint32_t counted;
+
+static void erase(uint32_t first, uint32_t last) {
+	CHECK(flash_erase_pages(FLASH_PAGE_OF(area) + first, FLASH_PAGE_OF(area) + last) == 0);
+	counted += last - first + 1;
+}
+
+/*
+ * Counts of the tracked pages against the simulator, and the summary
+ * against the counts
+ */
+static void check_counts(void) {
+	struct wear_summary s;
+	uint32_t i, total = 0, worst = 0;
+
+	for (i = 0; i < WEAR_MAX_PAGES; i++) {
+		CHECK(wear_count(PAGE_ADDR(i)) == iap_sim_erase_count(PAGE_ADDR(i)));
+		total += iap_sim_erase_count(PAGE_ADDR(i));
+		if (iap_sim_erase_count(PAGE_ADDR(i)) > worst) {
+			worst = iap_sim_erase_count(PAGE_ADDR(i));
+		}
+	}
+	for (; i < PAGES; i++) {
+		CHECK(wear_count(PAGE_ADDR(i)) == 0);
+	}
+
+	wear_summarize(&s);
+	CHECK(s.pages == WEAR_MAX_PAGES);
+	CHECK(s.total == total);
+	CHECK(s.worst_count == worst);
+	CHECK(wear_count((const void *)(uintptr_t)s.worst_page) == worst);
+}
+
+/*
+ * Reload from flash and check nothing was lost
+ */
+static void remount(void) {
+	struct wear_summary before, after;
+	uint32_t i, counts[PAGES];
+
+	wear_summarize(&before);
+	for (i = 0; i < PAGES; i++) {
+		counts[i] = wear_count(PAGE_ADDR(i));
+	}
+
+	CHECK(wear_mount() == 0);
+
+	wear_summarize(&after);
+	CHECK(after.pages == before.pages);
+	CHECK(after.total == before.total);
+	CHECK(after.worst_page == before.worst_page);
+	CHECK(after.worst_count == before.worst_count);
+	for (i = 0; i < PAGES; i++) {
+		CHECK(wear_count(PAGE_ADDR(i)) == counts[i]);
+	}
+}
+
+int main(void) {
+	uint32_t i, first, compactions, own;
+
+	test_init();
+	srand(1);
+	CHECK(wear_mount() == 0);
+	flash_set_erase_hook(wear_erased);
+
+	// Track the first WEAR_MAX_PAGES pages
+	for (i = 0; i < WEAR_MAX_PAGES; i++) {
+		erase(i, i);
+	}
+	check_counts();
+	remount();
+
+	own = iap_sim_stats.page_erases - counted;
+	compactions = wear_stats.compactions;
+	for (i = 0; i < 2000; i++) {
+		first = rand() % WEAR_MAX_PAGES;
+		if (rand() % 4 == 0) {
+			erase(first, first + rand() % (WEAR_MAX_PAGES - first));
+		} else {
+			erase(first, first);
+		}
+
+		if (wear_stats.compactions != compactions) {
+			// Straight after a compaction into the other bank
+			compactions = wear_stats.compactions;
+			check_counts();
+			remount();
+		} else if (i % 97 == 0) {
+			remount();
+		}
+	}
+	check_counts();
+	CHECK(wear_stats.compactions >= 4);
+	own = iap_sim_stats.page_erases - counted - own;
+
+	// Past the table
+	CHECK(wear_stats.untracked == 0);
+	erase(WEAR_MAX_PAGES, PAGES - 1);
+	erase(WEAR_MAX_PAGES, WEAR_MAX_PAGES);
+	CHECK(wear_stats.untracked == PAGES - WEAR_MAX_PAGES + 1);
+	check_counts();
+	remount();
+	check_counts();
+
+	printf("%u erases counted, %u compactions, %u erases of the counters"
+			" (%.4f per erase)\n", counted, wear_stats.compactions, own,
+			(double)own / counted);
+
+	return test_result("wear");
+}
@@ -0,0 +1,44 @@
+/*
+ * LPC8xx.h (host UART model)
+ *
+ * Just enough of the CMSIS device header for ../src/uart.c to build on the
+ * host against the USART model in test_uart.c. Time is counted in CPU
+ * cycles (uart_model_cycles); the model moves on, and runs the interrupt
+ * handler, each time interrupts are enabled or the CPU waits.
+ */
+
+#ifndef LPC8XX_H_HOST_UART_
+#define LPC8XX_H_HOST_UART_
+
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef struct {
+	__IO uint32_t SYSAHBCLKCTRL, PRESETCTRL, UARTCLKDIV, UARTFRGDIV, UARTFRGMULT;
+} LPC_SYSCON_TypeDef;
+
+typedef struct {
+	__IO uint32_t CFG, CTL, STAT, INTENSET, INTENCLR, RXDATA, RXDATA_STAT, TXDATA, BRG, INTSTAT;
+} LPC_USART_TypeDef;
+
+typedef enum { UART0_IRQn = 3 } IRQn_Type;
+
+extern LPC_SYSCON_TypeDef uart_model_syscon;
+extern LPC_USART_TypeDef uart_model_usart;
+extern uint32_t SystemCoreClock;
+extern uint64_t uart_model_cycles;
+
+#define LPC_SYSCON (&uart_model_syscon)
+#define LPC_USART0 (&uart_model_usart)
+
+static inline void NVIC_EnableIRQ(IRQn_Type irq) { (void)irq; }
+static inline void NVIC_DisableIRQ(IRQn_Type irq) { (void)irq; }
+
+void __disable_irq(void);
+void __enable_irq(void);
+void __WFI(void);
+
+void UART0_IRQHandler(void);
+
+#endif
@@ -26,6 +26,23 @@
 #include "print.h"
 #include "parse.h"
 #include "iap_driver.h"
+#include "iap_stats.h"
+#include "crc.h"
+#include "flash.h"
+#include "flash_async.h"
+#include "flash_counter.h"
+#include "eeprom_bank.h"
+#include "eeprom_txn.h"
+#include "eeprom_log.h"
+#include "eeprom_cache.h"
+#include "eeprom_ab.h"
+#include "kvstore.h"
+#include "binproto.h"
+#include "wear.h"
+#include "systick.h"
+#include "hal.h"
+#include "journal.h"
+#include "settings.h"
 
 // Default internal clock runs a 12MHz
 #define SYSTEM_CLOCK_SPEED_KHZ 12000
@@ -33,58 +50,149 @@
 // You may need to disable this to run on LPC810
 #define ENABLE_TIMER
 
+// Store the bank as an append-only log spread over several flash pages
+// instead of erasing and rewriting one page on every write (see eeprom_log.c)
+//#define ENABLE_LOG_STORE
 
+// Stage writes in an SRAM cache and commit them to flash in one go on the
+// F command, after EEPROM_CACHE_IDLE_MS without writes, or before reboot.
+// Defining EEPROM_CACHE_ERASES_PER_HOUR in the build instead commits each
+// write straight away while within that erase budget (see eeprom_cache.h)
+//#define ENABLE_WRITE_CACHE
 
-// Allocate a 64 byte aligned 64 byte block in flash memory for "EEPROM" storage
-const uint8_t eeprom_flashpage[64] __attribute__ ((aligned (64))) = {0};
+// Keep two copies of the bank with sequence number and CRC so that a
+// power failure during a write can't lose the bank (see eeprom_ab.c)
+//#define ENABLE_AB_COMMIT
 
+// Key/value store with variable length values (see kvstore.c)
+//#define ENABLE_KVSTORE
 
-/**
- * Configure SwitchMatrix to enable UART on pins used for in-circuit serial
- * programming. Code generated by NXP's SwitchMatrix PinMux configuration tool.
- *
- * UART RXD on SOIC package pin 19 (default for ISP mode)
- * UART TXD on SOIC package pin 5 (default for ISP mode)
- * RESET, SWD (SWDIO, SWCLK) enabled.
- */
-void SwitchMatrix_Init()
-{
-    /* Enable SWM clock */
-    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<7);
+// Accept SLIP framed binary read/write/commit requests alongside the text
+// commands (see binproto.h)
+//#define ENABLE_BINPROTO
 
-    /* Pin Assign 8 bit Configuration */
-    /* U0_TXD */
-    /* U0_RXD */
-    LPC_SWM->PINASSIGN0 = 0xffff0004UL;
+// Return to the prompt while a W command's erase and program steps run in
+// the background (see flash_async.c)
+//#define ENABLE_ASYNC_WRITE
 
-    /* Pin Assign 1 bit Configuration */
-    /* SWCLK */
-    /* SWDIO */
-    /* RESET */
-    LPC_SWM->PINENABLE0 = 0xffffffb3UL;
+// Keep persistent per-page erase counts and show wear with the X command
+// (see wear.c)
+//#define ENABLE_WEAR
+
+// Count boots in a bit clearing flash counter (see flash_counter.c)
+//#define ENABLE_BOOT_COUNTER
+
+// Journal boots, resets, write failures and formats in flash and list
+// them with the J command (see journal.c)
+//#define ENABLE_JOURNAL
+
+// Hold the typed settings of settings_schema.h in the bank and show / set
+// them by name with the P command (see settings.h). Needs the write cache
+// or log store, which stage the bytes of a field without a page rewrite,
+// or with SETTINGS_OVERLAY the key/value store.
+//#define ENABLE_SETTINGS
+
+// Extra named banks in their own flash pages, written independently of
+// the main bank with the B command (see eeprom_bank.h)
+//#define ENABLE_BANKS
+
+// Stage several byte writes and apply them in one commit of the bank with
+// the T command (see eeprom_txn.h)
+//#define ENABLE_TRANSACTIONS
+
+// Latency statistics of every IAP call, shown and reset with the S command
+// (see iap_stats.h). Every module that makes flash calls records them, so
+// this one has to be defined for the whole build (compiler defines, or
+// FEATURES in host/Makefile), not here: -DENABLE_IAP_STATS
+
+#if defined(ENABLE_LOG_STORE) && (defined(ENABLE_WRITE_CACHE) || defined(ENABLE_AB_COMMIT))
+#error "ENABLE_LOG_STORE can't be combined with ENABLE_WRITE_CACHE or ENABLE_AB_COMMIT"
+#endif
+
+#if defined(ENABLE_SETTINGS) && defined(SETTINGS_OVERLAY) && !defined(ENABLE_KVSTORE)
+#error "SETTINGS_OVERLAY needs ENABLE_KVSTORE"
+#endif
+
+#if defined(ENABLE_SETTINGS) && !defined(SETTINGS_OVERLAY) && !defined(ENABLE_WRITE_CACHE) && !defined(ENABLE_LOG_STORE)
+#error "ENABLE_SETTINGS needs ENABLE_WRITE_CACHE or ENABLE_LOG_STORE"
+#endif
+
+#if defined(ENABLE_ASYNC_WRITE) && (defined(ENABLE_LOG_STORE) || defined(ENABLE_WRITE_CACHE) || defined(ENABLE_AB_COMMIT))
+#error "ENABLE_ASYNC_WRITE can only be used with the single page bank"
+#endif
+
+
+// Maximum number of space separated args in a command line
+#define MAX_ARGS 8
+
+// Allocate a 64 byte aligned 64 byte block in flash memory for "EEPROM" storage
+const uint8_t eeprom_flashpage[64] FLASH_STORAGE = {0};
+
+#ifdef ENABLE_BOOT_COUNTER
+FLASH_COUNTER(boot_counter);
+#endif
+
+#ifdef ENABLE_BANKS
+// A rarely written configuration bank and a frequently written one
+EEPROM_BANK(config_bank, 128);
+EEPROM_BANK(counter_bank, 64);
+
+static const struct eeprom_bank *banks[] = {&config_bank, &counter_bank};
+#define BANK_COUNT (sizeof(banks) / sizeof(banks[0]))
+#endif
 
-}
 
 /**
- * Display contents of flash page used for the "EEPROM" to UART as 4 lines of
- * 16 bytes.
+ * Display contents of the "EEPROM" bank to UART as 4 lines of 16 bytes.
+ *
+ * @param data Pointer to 64 byte bank (flash page or SRAM image)
  */
-void display_eeprom_page () {
+void display_eeprom_page (const uint8_t *data) {
     int i,j;
 
     uart_send_string_z ("\r\nEEPROM page:\r\n");
 
     for (i = 0; i < 4; i++) {
-    	print_hex16((uint16_t)(&eeprom_flashpage) + (i * 16));
+    	print_hex16((uint16_t)(uintptr_t)data + (i * 16));
     	uart_send_string_z("  ");
     	for (j = 0; j<16; j++) {
-    		print_hex8(eeprom_flashpage[i*16+j]);
+    		print_hex8(data[i*16+j]);
     		uart_send_string_z(" ");
     	}
     	uart_send_string_z("\r\n");
     }
 }
 
+/**
+ * @return Pointer to the 64 byte bank in flash.
+ */
+const uint8_t *eeprom_flash () {
+#ifdef ENABLE_AB_COMMIT
+	return eeprom_ab_data();
+#else
+	// Not eeprom_flashpage itself: gcc may fold reads of it to its
+	// initial value
+	return FLASH_CONTENTS(eeprom_flashpage);
+#endif
+}
+
+/**
+ * @return Pointer to the current contents of the 64 byte bank.
+ */
+const uint8_t *eeprom_read () {
+#if defined(ENABLE_LOG_STORE)
+	return eeprom_log_image();
+#elif defined(ENABLE_WRITE_CACHE)
+	return eeprom_cache_image();
+#elif defined(ENABLE_ASYNC_WRITE)
+	// Contents being written, if a write is in progress
+	const uint8_t *pending = flash_async_pending(eeprom_flashpage);
+	return pending ? pending : eeprom_flash();
+#else
+	return eeprom_flash();
+#endif
+}
+
 /**
  * Write 64 byte page to flash.
  *
@@ -95,51 +203,407 @@ void display_eeprom_page () {
  * @return 0 for success, negative value for error.
  */
 int32_t eeprom_write (uint8_t *data) {
+#ifdef ENABLE_AB_COMMIT
+	return eeprom_ab_commit(data);
+#else
+#ifdef ENABLE_ASYNC_WRITE
+	flash_async_wait();
+#endif
+	return flash_write_page(eeprom_flashpage, data);
+#endif
+}
 
-	uint32_t iap_status;
+/**
+ * Commit a complete 64 byte image of the bank, whichever way the bank is
+ * stored.
+ *
+ * @param image Pointer to 64 byte word aligned block in SRAM.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_commit_image (uint8_t *image) {
+#if defined(ENABLE_LOG_STORE) || defined(ENABLE_WRITE_CACHE)
+	int32_t status = 0;
+	uint32_t i;
+	for (i = 0; i < 64 && status == 0; i++) {
+#ifdef ENABLE_LOG_STORE
+		status = eeprom_log_write(i, image[i]);
+#else
+		eeprom_cache_write(i, image[i]);
+#endif
+	}
+#ifdef ENABLE_WRITE_CACHE
+	status = eeprom_cache_flush();
+#endif
+	return status;
+#else
+	return eeprom_write(image);
+#endif
+}
 
-	iap_init();
+#ifdef ENABLE_SETTINGS
+#ifndef SETTINGS_OVERLAY
+/**
+ * Stage a byte write to the bank (settings_stage_fn).
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_stage_byte (uint32_t addr, uint8_t val) {
+#ifdef ENABLE_LOG_STORE
+	return eeprom_log_write(addr, val);
+#else
+	eeprom_cache_write(addr, val);
+	return 0;
+#endif
+}
+#endif
 
-	uint32_t flash_page = (uint32_t)&eeprom_flashpage >> 6;
-	uint32_t flash_sector = flash_page >> 4;
+/**
+ * Attach the settings to the bank (or key/value store) and apply the
+ * defaults if the stored settings aren't this schema version.
+ *
+ * @return 1 if the defaults were applied, 0 otherwise.
+ */
+int eeprom_settings_init () {
+#ifdef SETTINGS_OVERLAY
+	return settings_init(0, 0);
+#else
+	return settings_init(eeprom_read, eeprom_stage_byte);
+#endif
+}
 
-	// Example code checks MCU part ID, bootcode revision number and serial number. There are some
-	// differences in behavior across silicon revisions (in particular to do with ability
-	// to erase multiple sectors at the same time). In this case we require to be able to program
-	// just one sector, so this does not concern us.
+/**
+ * Display every setting as name = value (hex).
+ */
+void display_settings () {
+	uint32_t i;
+	for (i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+		uart_send_string_z((char *)settings_fields[i].name);
+		uart_send_string_z(" = ");
+		print_hex32(settings_get_field(&settings_fields[i]));
+		uart_send_string_z("\r\n");
+	}
+}
+#endif
 
-	/* Prepare the page for erase */
-	iap_status = (__e_iap_status) iap_prepare_sector(flash_sector, flash_sector);
-	if (iap_status != CMD_SUCCESS) return -4;
+/**
+ * Erase all storage in use ("factory reset"). Staged writes are discarded.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_format () {
+	int32_t status;
+#if defined(ENABLE_LOG_STORE)
+	status = eeprom_log_format();
+#elif defined(ENABLE_AB_COMMIT)
+	status = eeprom_ab_format();
+#else
+#ifdef ENABLE_ASYNC_WRITE
+	flash_async_wait();
+#endif
+	status = flash_format(eeprom_flashpage, sizeof(eeprom_flashpage));
+#endif
+#ifdef ENABLE_KVSTORE
+	if (status == 0) {
+		status = kvstore_format();
+	}
+#endif
+#ifdef ENABLE_WRITE_CACHE
+	eeprom_cache_init(eeprom_flash, eeprom_write);
+#endif
+#ifdef ENABLE_SETTINGS
+	if (status == 0) {
+		eeprom_settings_init();
+	}
+#endif
+	return status;
+}
 
-	/* Erase the page */
-	iap_status = (__e_iap_status) iap_erase_page(flash_page, flash_page);
-	if (iap_status != CMD_SUCCESS) return -5;
+/**
+ * @return Current SCT count if timer is enabled, otherwise 0.
+ */
+int32_t timer_now () {
+#ifdef ENABLE_TIMER
+	return hal_timer_now();
+#else
+	return 0;
+#endif
+}
 
-	/* Prepare the page for writing */
-	iap_status = (__e_iap_status) iap_prepare_sector(flash_sector, flash_sector);
-	if (iap_status != CMD_SUCCESS) return -6;
+/**
+ * Report result of a flash write and, if the timer is enabled, the time
+ * elapsed since start_time.
+ */
+void report_write (int32_t status, int32_t start_time) {
 
-	/* Write data to page */
-	iap_status = (__e_iap_status) iap_copy_ram_to_flash(data,
-			(void *)&eeprom_flashpage, 64);
-	if (iap_status != CMD_SUCCESS) return -7;
+	int32_t end_time = timer_now();
 
-	return 0;
+	if (status != 0) {
+#ifdef ENABLE_JOURNAL
+		journal_append(JOURNAL_WRITE_FAIL, -status);
+#endif
+		uart_send_string_z("ERR: write failed ");
+		print_decimal(status);
+		if (status == -8) {
+			uart_send_string_z(" (verify) at offset ");
+			print_decimal(flash_verify_stats.last_offset);
+		}
+		uart_send_string_z("\r\n");
+	}
+
+#ifdef ENABLE_TIMER
+	uart_send_string_z("time to write: ");
+	print_decimal( (end_time - start_time) / SYSTEM_CLOCK_SPEED_KHZ);
+	uart_send_string_z(" ms\r\n");
+#else
+	(void)end_time;
+	(void)start_time;
+#endif
+}
+
+#ifdef ENABLE_ASYNC_WRITE
+// Start time of background write
+static int32_t async_start_time;
+
+/**
+ * Called when a background write completes.
+ */
+void async_write_done (int32_t status) {
+	report_write(status, async_start_time);
+}
+#endif
+
+/**
+ * Display a labelled decimal value on its own line.
+ */
+void print_stat (char *label, int32_t value) {
+	uart_send_string_z(label);
+	print_decimal(value);
+	uart_send_string_z("\r\n");
+}
+
+/**
+ * Display flash statistics, then reset IAP latency statistics. Latencies
+ * are in SCT ticks. Histogram bins are log2 (see iap_stats.h).
+ */
+void display_stats () {
+#ifdef ENABLE_IAP_STATS
+	int i, j;
+#endif
+
+	print_stat("write skipped: ", flash_write_stats.skip);
+	print_stat("write program only: ", flash_write_stats.program);
+	print_stat("write erase+program: ", flash_write_stats.erase);
+	print_stat("verify mode: ", flash_verify_mode);
+	print_stat("verify checks: ", flash_verify_stats.checks);
+	print_stat("verify failures: ", flash_verify_stats.failures);
+#ifdef ENABLE_WRITE_CACHE
+	print_stat("cache commits: ", eeprom_cache_stats.commits);
+	print_stat("cache writes over budget: ", eeprom_cache_stats.throttled);
+#endif
+#ifdef ENABLE_TRANSACTIONS
+	print_stat("txn commits: ", eeprom_txn_stats.commits);
+	print_stat("txn aborts: ", eeprom_txn_stats.aborts);
+	print_stat("txn writes: ", eeprom_txn_stats.writes);
+#endif
+#ifdef ENABLE_LOG_STORE
+	print_stat("log erases: ", eeprom_log_stats.erases);
+	print_stat("log erases in write: ", eeprom_log_stats.foreground_erases);
+#endif
+	print_stat("rx overrun: ", uart_rx_stats.overrun);
+	print_stat("rx framing: ", uart_rx_stats.framing);
+	print_stat("rx lines dropped: ", uart_rx_stats.dropped);
+	print_stat("rx lines truncated: ", uart_rx_stats.truncated);
+#ifdef ENABLE_BINPROTO
+	print_stat("frames: ", binproto_stats.frames);
+	print_stat("frames bad crc: ", binproto_stats.crc);
+	print_stat("frames dropped: ", binproto_stats.dropped);
+#endif
+#ifdef ENABLE_ASYNC_WRITE
+	print_stat("async writes: ", flash_async_stats.writes);
+	print_stat("async erase step max: ", flash_async_stats.step_max[FLASH_ASYNC_ERASE]);
+	print_stat("async program step max: ", flash_async_stats.step_max[FLASH_ASYNC_PROGRAM]);
+#endif
+
+#ifdef ENABLE_IAP_STATS
+	for (i = 0; i < IAP_OP_COUNT; i++) {
+		struct iap_op_stats *st = &iap_stats[i];
+		uart_send_string_z(iap_op_names[i]);
+		uart_send_string_z(":\r\n");
+		print_stat(" calls: ", st->calls);
+		if (st->calls == 0) continue;
+		print_stat(" failures: ", st->failures);
+		print_stat(" busy: ", st->busy);
+		print_stat(" min: ", st->min);
+		print_stat(" max: ", st->max);
+		print_stat(" mean: ", (uint32_t)(st->total / st->calls));
+		uart_send_string_z(" hist:");
+		for (j = 0; j < IAP_STATS_BINS; j++) {
+			uart_send_string_z(" ");
+			print_decimal(st->hist[j]);
+		}
+		uart_send_string_z("\r\n");
+	}
+
+	iap_stats_reset();
+#endif
+}
+
+#ifdef ENABLE_BANKS
+/**
+ * Display a named bank, 16 bytes to a line.
+ */
+void display_bank (const struct eeprom_bank *bank) {
+	const uint8_t *data = eeprom_bank_data(bank);
+	uint32_t i;
+
+	uart_send_string_z((char *)bank->name);
+	uart_send_string_z(":");
+	for (i = 0; i < bank->size; i++) {
+		if (i % 16 == 0) {
+			uart_send_string_z("\r\n");
+			print_hex16((uint16_t)(uintptr_t)data + i);
+			uart_send_string_z(" ");
+		}
+		uart_send_string_z(" ");
+		print_hex8(data[i]);
+	}
+	uart_send_string_z("\r\n");
+}
+#endif
+
+#ifdef ENABLE_JOURNAL
+/**
+ * Display the newest journal records, newest first.
+ *
+ * @param n Number of records
+ */
+void display_journal (uint32_t n) {
+	static const char *names[] = {"?", "boot", "reset", "write fail", "format"};
+	const struct journal_record *r;
+	uint32_t i;
+
+	for (i = 0; i < n && (r = journal_get(i)) != 0; i++) {
+		print_decimal(r->seq);
+		uart_send_string_z(" ");
+		print_decimal(r->ms);
+		uart_send_string_z("ms ");
+		uart_send_string_z((char *)names[r->type <= JOURNAL_FORMAT ? r->type : 0]);
+		uart_send_string_z(" ");
+		print_decimal(r->arg);
+		uart_send_string_z("\r\n");
+	}
+}
+#endif
+
+#ifdef ENABLE_WEAR
+/**
+ * Display erase counts and projected time until the most used page
+ * reaches its erase endurance.
+ */
+void display_wear () {
+	struct wear_summary s;
+
+	wear_summarize(&s);
+	print_stat("pages tracked: ", s.pages);
+	print_stat("total erases: ", s.total);
+	uart_send_string_z("most worn page: ");
+	print_hex16(s.worst_page);
+	uart_send_string_z("\r\n");
+	print_stat("most worn page erases: ", s.worst_count);
+	if (s.hours_left == WEAR_NO_LIMIT) {
+		uart_send_string_z("no recent erases\r\n");
+	} else {
+		print_stat("recent erases/hour: ", s.rate);
+		print_stat("hours to endurance limit: ", s.hours_left);
+	}
+	print_stat("untracked erases: ", wear_stats.untracked);
+	print_stat("counter rewrites: ", wear_stats.compactions);
+}
+#endif
+
+#ifdef ENABLE_TIMER
+// Times each CRC is repeated by display_crc_timing()
+#define CRC_TIMING_RUNS (16)
+
+/*
+ * Display SCT ticks (CPU cycles) per byte, to two decimal places, of
+ * CRC_TIMING_RUNS calculations over len bytes.
+ */
+static void print_cycles_per_byte (uint32_t ticks, uint32_t len) {
+	uint32_t hundredths = ticks * 100 / (CRC_TIMING_RUNS * len);
+
+	print_decimal(hundredths / 100);
+	uart_send_byte('.');
+	uart_send_byte('0' + (hundredths / 10) % 10);
+	uart_send_byte('0' + hundredths % 10);
+}
+
+/**
+ * Display the cost of the CRC in cycles per byte over 64 to 1024 bytes.
+ * Only the implementation built in is timed: the CRC engine or, if built
+ * with CRC_SOFTWARE (or for the host), table lookup. Build both ways to
+ * compare them. The data is code flash (from display_stats()): SRAM is
+ * too small to hold 1KiB.
+ */
+void display_crc_timing () {
+	const uint8_t *data = (const uint8_t *)(uintptr_t)display_stats;
+	uint32_t len, start;
+	int i;
+
+	for (len = 64; len <= 1024; len *= 2) {
+		start = timer_now();
+		for (i = 0; i < CRC_TIMING_RUNS; i++) {
+			crc16_update(CRC16_INIT, data, len);
+		}
+		print_decimal(len);
+#ifdef CRC_HARDWARE
+		uart_send_string_z(" bytes: engine ");
+#else
+		uart_send_string_z(" bytes: table ");
+#endif
+		print_cycles_per_byte(timer_now() - start, len);
+		uart_send_string_z(" cycles/byte\r\n");
+	}
+}
+#endif
+
+/**
+ * Work done while waiting for a line of input.
+ */
+void idle () {
+#ifdef ENABLE_ASYNC_WRITE
+	flash_async_poll();
+#endif
+#ifdef ENABLE_BINPROTO
+	binproto_poll();
+#endif
+#ifdef ENABLE_WRITE_CACHE
+	eeprom_cache_idle();
+#endif
+	// Erase retired pages ahead of the next write
+#ifdef ENABLE_LOG_STORE
+	eeprom_log_idle();
+#endif
+#ifdef ENABLE_AB_COMMIT
+	eeprom_ab_idle();
+#endif
+#ifdef ENABLE_BOOT_COUNTER
+	flash_counter_idle(boot_counter);
+#endif
+#ifdef ENABLE_JOURNAL
+	journal_idle();
+#endif
 }
 
 int main(void) {
 
-	SwitchMatrix_Init();
+	hal_init();
+	crc_init();
 
 #ifdef ENABLE_TIMER
-	//
-	// Enable the SCT clock for timing flash write op. Ref UM10601 chapter 10.
-	//
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 8);
-	LPC_SYSCON->PRESETCTRL |= ( 1<< 8);
-	LPC_SCT->CONFIG = 1;		 // config as bus clocked (12MHz) 32 bit timer
-	LPC_SCT->CTRL_U &= ~(1<<2);  // unhalt to start clock
+	// Start timer for timing flash write ops
+	hal_timer_init();
 #endif
 
 	//
@@ -151,29 +615,123 @@ int main(void) {
     uart_send_string_z ("LPC8xx_Flash_EEPROM \r\n");
     //uart_send_string_z ("Documentation at https://github.com/jdesbonnet/LPC8xx_Flash_EEPROM\r\n");
 
+    // Systick is needed by the wear rate and the write cache
+    systick_init();
+
+#ifdef ENABLE_WEAR
+    // Load erase counters first so that erases made by the mounts below
+    // are counted
+    wear_mount();
+    flash_set_erase_hook(wear_erased);
+#endif
+
+#ifdef ENABLE_JOURNAL
+    // Find head of journal
+    journal_mount();
+    journal_append(JOURNAL_BOOT, 0);
+#endif
+
+#ifdef ENABLE_LOG_STORE
+    // Rebuild bank from log region
+    eeprom_log_mount();
+#endif
+
+#ifdef ENABLE_KVSTORE
+    // Build key index
+    kvstore_mount();
+#endif
+
+#ifdef ENABLE_AB_COMMIT
+    // Select newest valid copy of bank
+    eeprom_ab_mount();
+#endif
+
+#ifdef ENABLE_WRITE_CACHE
+    eeprom_cache_init(eeprom_flash, eeprom_write);
+#endif
+
+#ifdef ENABLE_SETTINGS
+    // Apply defaults if the bank doesn't hold this settings version
+    if (eeprom_settings_init()) {
+    	uart_send_string_z("settings reset to defaults\r\n");
+    }
+#endif
+
+#ifdef ENABLE_BINPROTO
+    binproto_init(eeprom_read, eeprom_commit_image);
+    uart_set_rx_hook(binproto_rx_byte);
+#endif
+
+#ifdef ENABLE_BOOT_COUNTER
+    flash_counter_increment(boot_counter);
+    print_stat("boot count: ", flash_counter_read(boot_counter));
+#endif
+
+    // Periodic wake up for idle work
+    uart_set_idle_hook(idle);
+
     // Show contents of 'EEPROM' flash page
-    display_eeprom_page();
+    display_eeprom_page(eeprom_read());
 
     // Show allowed commands
     uart_send_string_z ("\r\nCommands:\r\n");
     uart_send_string_z (" W <addr> <val> : write byte to EEPROM bank\r\n");
+#ifdef ENABLE_WRITE_CACHE
+    uart_send_string_z (" F              : flush staged writes to flash\r\n");
+#endif
     uart_send_string_z (" R              : read EEPROM bank\r\n");
+#ifdef ENABLE_KVSTORE
+    uart_send_string_z (" K <key> <hex>  : set key (no <hex> to delete)\r\n");
+    uart_send_string_z (" G <key>        : get key\r\n");
+#endif
+    uart_send_string_z (" E              : erase all storage (factory reset)\r\n");
+    uart_send_string_z (" S              : show and reset flash statistics\r\n");
+    uart_send_string_z (" V <mode>       : verify writes 0=off 1=ROM 2=software 3=CRC\r\n");
+#ifdef ENABLE_TIMER
+#ifdef CRC_HARDWARE
+    uart_send_string_z (" C              : time CRC engine (cycles/byte)\r\n");
+#else
+    uart_send_string_z (" C              : time CRC table (cycles/byte)\r\n");
+#endif
+#endif
+#ifdef ENABLE_WEAR
+    uart_send_string_z (" X              : show flash wear\r\n");
+#endif
+#ifdef ENABLE_TRANSACTIONS
+    uart_send_string_z (" T              : begin transaction (W staged until T C)\r\n");
+    uart_send_string_z (" T C | T A      : commit / abort transaction\r\n");
+    uart_send_string_z (" T <a> <v> ...  : write bytes in one commit\r\n");
+#endif
+#ifdef ENABLE_BANKS
+    uart_send_string_z (" B <n> <a> <v>  : write byte to bank n (no <a> <v>: show bank)\r\n");
+#endif
+#ifdef ENABLE_SETTINGS
+    uart_send_string_z (" P <name> <hex> : set setting (no args: show all)\r\n");
+#endif
+#ifdef ENABLE_JOURNAL
+    uart_send_string_z (" J <n>          : show newest n (hex) journal records\r\n");
+#endif
     uart_send_string_z (" Z              : reboot device\r\n");
     uart_send_string_z (" <addr>         : index in bank from 0 to 40 (hex)\r\n");
     uart_send_string_z (" <val>          : byte value from 0 to FF (hex)\r\n");
 
     // Used to parse command
     int argc;
-    char *args[4], buf[20], *s;
+    char *args[MAX_ARGS], *buf, *s;
+    uint32_t len;
 
-    // 64 byte block in SRAM: needed as eeprom_write() param must be in SRAM.
-	uint8_t rambuf[64];
+#if !defined(ENABLE_LOG_STORE) && !defined(ENABLE_WRITE_CACHE)
+    // 64 byte block in SRAM: needed as eeprom_write() param must be in SRAM
+    // and word aligned.
+	uint8_t rambuf[64] __attribute__ ((aligned (4)));
+#endif
 
     while (1) {
 
-    	// Display prompt and wait for CR terminated line of input
+    	// Display prompt and wait for CR terminated line of input. The line
+    	// is split in place in the UART receive slot.
         uart_send_string_z ("> ");
-    	uart_read_line(buf);
+    	buf = uart_read_line(&len);
 
     	// Ignore empty lines
     	if (buf[0]==0) {
@@ -184,7 +742,7 @@ int main(void) {
 		args[0] = s = buf;
 		argc = 1;
 		while (*s != 0) {
-			if (*s == ' ') {
+			if (*s == ' ' && argc < MAX_ARGS) {
 				*s = 0;
 				args[argc++] = s+1;
 			}
@@ -198,6 +756,10 @@ int main(void) {
     		// W <addr> <val>
     		// for example:
     		// W 03 5F
+    		if (argc < 3) {
+    			uart_send_string_z("ERR: missing args\r\n");
+    			continue;
+    		}
     		int addr = parse_hex(args[1]);
     		int val = parse_hex(args[2]);
 
@@ -210,38 +772,232 @@ int main(void) {
     			continue;
     		}
 
+#ifdef ENABLE_TRANSACTIONS
+    		// Part of open transaction: applied by T C
+    		if (eeprom_txn_is_open()) {
+    			eeprom_txn_write(addr, val);
+    			break;
+    		}
+#endif
+
+#ifdef ENABLE_WRITE_CACHE
+    		// Stage in SRAM. Committed by F, idle timeout (or erase
+    		// budget) or reboot.
+    		eeprom_cache_write(addr, val);
+#elif defined(ENABLE_ASYNC_WRITE)
+    		// Start background write of bank (including any write still
+    		// in progress). Result is reported by async_write_done().
+    		memcpy(rambuf,eeprom_read(),64);
+    		rambuf[addr] = val;
+    		flash_async_wait();
+    		async_start_time = timer_now();
+    		flash_async_write_page(eeprom_flashpage, rambuf, async_write_done);
+#else
+    		int32_t start_time = timer_now();
+
+#ifdef ENABLE_LOG_STORE
+    		// Append record to log
+    		int32_t status = eeprom_log_write(addr, val);
+#else
     		// Copy from flash page to SRAM buffer
-    		memcpy(rambuf,eeprom_flashpage,64);
+    		memcpy(rambuf,eeprom_flash(),64);
 
     		// Set byte
     		rambuf[addr] = val;
 
     		// Write back from SRAM to flash
+    		int32_t status = eeprom_write(rambuf);
+#endif
 
-#ifdef ENABLE_TIMER
-    		int32_t start_time = LPC_SCT->COUNT_U;
+    		report_write(status, start_time);
 #endif
-    		eeprom_write(rambuf);
+    		break;
+    	}
 
-    		int32_t end_time = LPC_SCT->COUNT_U;
+#ifdef ENABLE_WRITE_CACHE
+    	case 'F' : {
+    		int32_t start_time = timer_now();
+    		report_write(eeprom_cache_flush(), start_time);
+    		break;
+    	}
+#endif
 
-#ifdef ENABLE_TIMER
-    		uart_send_string_z("time to write: ");
-    		print_decimal( (end_time - start_time) / SYSTEM_CLOCK_SPEED_KHZ);
-    		uart_send_string_z(" ms\r\n");
+    	case 'R' : {
+    		display_eeprom_page(eeprom_read());
+    		break;
+    	}
+#ifdef ENABLE_KVSTORE
+    	case 'K' : {
+    		// Expecting format
+    		// K <key> <hex bytes>
+    		// for example:
+    		// K 02 0A1B2C
+    		if (argc < 2) {
+    			uart_send_string_z("ERR: missing args\r\n");
+    			continue;
+    		}
+    		uint8_t value[KVSTORE_MAX_VALUE];
+    		int len = (argc > 2) ? parse_hex_bytes((uint8_t *)args[2], value, sizeof(value)) : 0;
+    		if (len < 0) {
+    			uart_send_string_z("ERR: bad value\r\n");
+    			continue;
+    		}
+    		int32_t start_time = timer_now();
+    		report_write(kvstore_set(parse_hex(args[1]), value, len), start_time);
+    		break;
+    	}
+    	case 'G' : {
+    		uint32_t i, len;
+    		if (argc < 2) {
+    			uart_send_string_z("ERR: missing args\r\n");
+    			continue;
+    		}
+    		const uint8_t *value = kvstore_get(parse_hex(args[1]), &len);
+    		if (value == 0) {
+    			uart_send_string_z("not set\r\n");
+    			continue;
+    		}
+    		for (i = 0; i < len; i++) {
+    			print_hex8(value[i]);
+    		}
+    		uart_send_string_z("\r\n");
+    		break;
+    	}
 #endif
 
+    	case 'E' : {
+    		int32_t start_time = timer_now();
+#ifdef ENABLE_TRANSACTIONS
+    		// Staged writes were made against the old contents
+    		eeprom_txn_abort();
+#endif
+    		report_write(eeprom_format(), start_time);
+#ifdef ENABLE_JOURNAL
+    		// The journal itself is kept
+    		journal_append(JOURNAL_FORMAT, 0);
+#endif
+    		break;
+    	}
+    	case 'S' : {
+    		display_stats();
+    		break;
+    	}
+    	case 'V' : {
+    		// Select how writes are verified, so the cost of each can be
+    		// compared with S
+    		uint32_t mode = (argc > 1) ? parse_hex(args[1]) : FLASH_VERIFY_OFF;
+    		if (mode > FLASH_VERIFY_CRC) {
+    			uart_send_string_z("ERR: bad mode\r\n");
+    			continue;
+    		}
+    		flash_verify_mode = mode;
     		break;
     	}
+#ifdef ENABLE_TRANSACTIONS
+    	case 'T' : {
+    		int32_t start_time;
+    		int i;
 
-    	case 'R' : {
-    		display_eeprom_page();
+    		if (argc == 2 && args[1][0] == 'A') {
+    			eeprom_txn_abort();
+    			continue;
+    		}
+    		if ( ! (argc == 2 && args[1][0] == 'C')) {
+    			// Begin, and for a batch stage the <addr> <val> pairs
+    			if (argc % 2 == 0) {
+    				uart_send_string_z("ERR: missing args\r\n");
+    				continue;
+    			}
+    			for (i = 1; i < argc; i += 2) {
+    				if (parse_hex(args[i]) >= 0x40 || parse_hex(args[i + 1]) > 0xFF) {
+    					break;
+    				}
+    			}
+    			if (i < argc) {
+    				uart_send_string_z("ERR: bad addr or val\r\n");
+    				continue;
+    			}
+    			if (eeprom_txn_begin(eeprom_read()) != 0) {
+    				uart_send_string_z("ERR: transaction open\r\n");
+    				continue;
+    			}
+    			if (argc == 1) {
+    				continue;
+    			}
+    			for (i = 1; i < argc; i += 2) {
+    				eeprom_txn_write(parse_hex(args[i]), parse_hex(args[i + 1]));
+    			}
+    		}
+    		start_time = timer_now();
+    		report_write(eeprom_txn_commit(eeprom_commit_image), start_time);
     		break;
     	}
+#endif
+#ifdef ENABLE_BANKS
+    	case 'B' : {
+    		uint32_t n = (argc > 1) ? parse_hex(args[1]) : 0;
+    		if (n >= BANK_COUNT) {
+    			uart_send_string_z("ERR: no such bank\r\n");
+    			continue;
+    		}
+    		if (argc < 4) {
+    			display_bank(banks[n]);
+    			continue;
+    		}
+    		uint8_t val = parse_hex(args[3]);
+    		int32_t start_time = timer_now();
+    		report_write(eeprom_bank_write(banks[n], parse_hex(args[2]), &val, 1), start_time);
+    		break;
+    	}
+#endif
+#ifdef ENABLE_SETTINGS
+    	case 'P' : {
+    		const struct settings_field *f;
+    		if (argc < 3) {
+    			display_settings();
+    			continue;
+    		}
+    		if ((f = settings_find(args[1])) == 0) {
+    			uart_send_string_z("ERR: no such setting\r\n");
+    			continue;
+    		}
+    		int32_t start_time = timer_now();
+    		report_write(settings_set_field(f, parse_hex(args[2])), start_time);
+    		break;
+    	}
+#endif
+#ifdef ENABLE_JOURNAL
+    	case 'J' : {
+    		display_journal((argc > 1) ? parse_hex(args[1]) : 8);
+    		break;
+    	}
+#endif
+#ifdef ENABLE_TIMER
+    	case 'C' : {
+    		display_crc_timing();
+    		break;
+    	}
+#endif
+#ifdef ENABLE_WEAR
+    	case 'X' : {
+    		display_wear();
+    		break;
+    	}
+#endif
     	case 'Z' : {
+#ifdef ENABLE_WRITE_CACHE
+    		// Don't lose staged writes
+    		eeprom_cache_flush();
+#endif
+#ifdef ENABLE_ASYNC_WRITE
+    		flash_async_wait();
+#endif
+#ifdef ENABLE_JOURNAL
+    		journal_append(JOURNAL_RESET, 'Z');
+#endif
     		uart_send_string_z("rebooting!\r\n");
     		uart_drain();
-    		NVIC_SystemReset();
+    		hal_reset();
     	}
     	default : {
     		uart_send_string_z("ERR: invalid cmd\r\n");
@@ -0,0 +1,186 @@
+/*
+ * binproto.c
+ *
+ * Binary framed protocol for bulk 'EEPROM' bank access.
+ *
+ * binproto_rx_byte() is installed as the UART receive hook and runs in the
+ * UART IRQ handler. It claims bytes from a SLIP END byte up to the next
+ * END byte, decoding them into the frame buffer. Other bytes are left to
+ * the text console. The complete frame is processed and answered from the
+ * main loop by binproto_poll().
+ */
+
+#include <string.h>
+
+#include "uart.h"
+#include "crc.h"
+#include "binproto.h"
+
+volatile struct binproto_stats binproto_stats;
+
+static binproto_read_fn read_fn;
+static binproto_commit_fn commit_fn;
+
+// Frame being received (IRQ handler) or processed (main loop)
+static uint8_t frame[BINPROTO_MAX_FRAME];
+static volatile uint32_t frame_len;
+static volatile int frame_ready = 0;
+static int in_frame = 0, escaped = 0, overflow = 0;
+
+// Bank image staged by write commands
+static uint8_t stage[BINPROTO_BANK_SIZE] __attribute__ ((aligned (4)));
+static int staged = 0;
+
+/**
+ * @param read Function returning the current bank contents
+ * @param commit Function committing a bank image to flash
+ */
+void binproto_init(binproto_read_fn read, binproto_commit_fn commit) {
+	read_fn = read;
+	commit_fn = commit;
+}
+
+/**
+ * UART receive hook, called from the IRQ handler for each byte received.
+ *
+ * @return 1 if the byte is part of a binary frame, 0 if it is for the
+ * text console.
+ */
+int binproto_rx_byte(uint8_t c) {
+
+	if ( ! in_frame) {
+		if (c != BINPROTO_END) {
+			return 0;
+		}
+		in_frame = 1;
+		escaped = 0;
+		overflow = frame_ready;	// can't receive until previous frame is processed
+		if ( ! frame_ready) {
+			frame_len = 0;
+		}
+		return 1;
+	}
+
+	if (c == BINPROTO_END) {
+		if (overflow) {
+			binproto_stats.dropped++;
+		} else if (frame_len == 0) {
+			// Back to back END bytes: keep waiting for frame
+			return 1;
+		} else {
+			frame_ready = 1;
+		}
+		in_frame = 0;
+		return 1;
+	}
+
+	if (c == BINPROTO_ESC) {
+		escaped = 1;
+		return 1;
+	}
+	if (escaped) {
+		c = (c == BINPROTO_ESC_END) ? BINPROTO_END : BINPROTO_ESC;
+		escaped = 0;
+	}
+
+	if (frame_len == BINPROTO_MAX_FRAME) {
+		overflow = 1;
+	}
+	if ( ! overflow) {
+		frame[frame_len++] = c;
+	}
+	return 1;
+}
+
+static void send_slip_byte(uint8_t c) {
+	if (c == BINPROTO_END) {
+		uart_send_byte(BINPROTO_ESC);
+		uart_send_byte(BINPROTO_ESC_END);
+	} else if (c == BINPROTO_ESC) {
+		uart_send_byte(BINPROTO_ESC);
+		uart_send_byte(BINPROTO_ESC_ESC);
+	} else {
+		uart_send_byte(c);
+	}
+}
+
+static void respond(uint8_t cmd, uint8_t status, uint8_t addr, const uint8_t *data, uint8_t len) {
+	uint8_t h[4] = {cmd | BINPROTO_RESPONSE, status, addr, len};
+	uint16_t crc = crc16_update(crc16(h, sizeof(h)), data, len);
+	uint32_t i;
+
+	uart_send_byte(BINPROTO_END);
+	for (i = 0; i < sizeof(h); i++) {
+		send_slip_byte(h[i]);
+	}
+	for (i = 0; i < len; i++) {
+		send_slip_byte(data[i]);
+	}
+	send_slip_byte(crc & 0xFF);
+	send_slip_byte(crc >> 8);
+	uart_send_byte(BINPROTO_END);
+}
+
+/**
+ * Process a received frame, if any, and send the response. Call from the
+ * main loop (eg the UART idle hook).
+ */
+void binproto_poll(void) {
+	uint8_t cmd, addr, len, status = BINPROTO_OK;
+	uint32_t n = frame_len;
+
+	if ( ! frame_ready) {
+		return;
+	}
+
+	binproto_stats.frames++;
+	cmd = frame[0];
+	addr = (n > 1) ? frame[1] : 0;
+	len = (n > 2) ? frame[2] : 0;
+
+	if (n < 5 || (frame[n - 2] | (frame[n - 1] << 8)) != crc16(frame, n - 2)) {
+		binproto_stats.crc++;
+		status = BINPROTO_ERR_CRC;
+	} else if (addr + len > BINPROTO_BANK_SIZE) {
+		status = BINPROTO_ERR_RANGE;
+	} else {
+		switch (cmd) {
+		case BINPROTO_CMD_READ:
+			if (n != 5) {
+				status = BINPROTO_ERR_CMD;
+				break;
+			}
+			frame_ready = 0;
+			respond(cmd, BINPROTO_OK, addr, read_fn() + addr, len);
+			return;
+		case BINPROTO_CMD_WRITE:
+		case BINPROTO_CMD_WRITE_COMMIT:
+			if (n != 5 + (uint32_t)len) {
+				status = BINPROTO_ERR_CMD;
+				break;
+			}
+			if ( ! staged) {
+				memcpy(stage, read_fn(), BINPROTO_BANK_SIZE);
+				staged = 1;
+			}
+			memcpy(stage + addr, frame + 3, len);
+			if (cmd == BINPROTO_CMD_WRITE) {
+				break;
+			}
+			// fall through
+		case BINPROTO_CMD_COMMIT:
+			if (staged) {
+				staged = 0;
+				if (commit_fn(stage) != 0) {
+					status = BINPROTO_ERR_FLASH;
+				}
+			}
+			break;
+		default:
+			status = BINPROTO_ERR_CMD;
+		}
+	}
+
+	frame_ready = 0;
+	respond(cmd, status, addr, 0, 0);
+}
@@ -0,0 +1,66 @@
+/*
+ * binproto.h
+ *
+ * Binary framed protocol for bulk 'EEPROM' bank access, alongside the text
+ * console. Frames are SLIP encoded (RFC 1055) and carry a CRC-16.
+ *
+ * Request frame:  cmd addr len data[len] crc_lo crc_hi
+ * Response frame: cmd|0x80 status addr len data[len] crc_lo crc_hi
+ *
+ * CRC is CRC-16/CCITT (see crc.h) of all preceding bytes of the frame.
+ * Read requests have no data; write requests and read responses carry len
+ * bytes of data.
+ */
+
+#ifndef BINPROTO_H_
+#define BINPROTO_H_
+
+#include <stdint.h>
+
+// SLIP special bytes
+#define BINPROTO_END (0xC0)
+#define BINPROTO_ESC (0xDB)
+#define BINPROTO_ESC_END (0xDC)
+#define BINPROTO_ESC_ESC (0xDD)
+
+// Size of bank and largest data block in a frame
+#define BINPROTO_BANK_SIZE (64)
+
+// Largest frame (excluding SLIP encoding)
+#define BINPROTO_MAX_FRAME (4 + BINPROTO_BANK_SIZE + 2)
+
+// Commands
+#define BINPROTO_CMD_READ ('r')			// read len bytes from addr
+#define BINPROTO_CMD_WRITE ('w')		// stage len bytes at addr
+#define BINPROTO_CMD_COMMIT ('c')		// commit staged bytes to flash
+#define BINPROTO_CMD_WRITE_COMMIT ('W')	// stage and commit in one round trip
+
+// Bit set in cmd byte of a response
+#define BINPROTO_RESPONSE (0x80)
+
+// Response status
+#define BINPROTO_OK (0)
+#define BINPROTO_ERR_CRC (1)
+#define BINPROTO_ERR_CMD (2)
+#define BINPROTO_ERR_RANGE (3)
+#define BINPROTO_ERR_FLASH (4)
+
+struct binproto_stats {
+	uint32_t frames;	// frames processed
+	uint32_t crc;		// frames with bad CRC
+	uint32_t dropped;	// frames dropped (too long, or previous frame not yet processed)
+};
+
+extern volatile struct binproto_stats binproto_stats;
+
+// Returns the current 64 byte bank contents
+typedef const uint8_t *(*binproto_read_fn)(void);
+
+// Commits a 64 byte image of the bank to flash
+typedef int32_t (*binproto_commit_fn)(uint8_t *image);
+
+void binproto_init(binproto_read_fn read, binproto_commit_fn commit);
+int binproto_rx_byte(uint8_t c);
+void binproto_poll(void);
+
+#endif /* BINPROTO_H_ */
@@ -0,0 +1,33 @@
+/*
+ * crc.h
+ *
+ * CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF, no reflection).
+ * Calculated by the CRC engine on the LPC8xx and by table lookup
+ * otherwise, with identical results.
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stdint.h>
+
+#define CRC16_INIT (0xFFFF)
+
+// Use the CRC engine when building for the LPC8xx, unless CRC_SOFTWARE
+// is defined
+#if defined(__LPC8XX__) && !defined(IAP_SIM) && !defined(CRC_SOFTWARE)
+#define CRC_HARDWARE
+#endif
+
+void crc_init(void);
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t len);
+uint16_t crc16(const uint8_t *data, uint32_t len);
+
+// The implementation crc16_update() uses (only one is built in)
+#ifdef CRC_HARDWARE
+uint16_t crc16_update_hardware(uint16_t crc, const uint8_t *data, uint32_t len);
+#else
+uint16_t crc16_update_software(uint16_t crc, const uint8_t *data, uint32_t len);
+#endif
+
+#endif /* CRC_H_ */
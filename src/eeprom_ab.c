@@ -0,0 +1,195 @@
+/*
+ * eeprom_ab.c
+ *
+ * Power-fail safe 'EEPROM' bank using two copies (A and B) in flash.
+ *
+ * Each copy (slot) takes two flash pages: a data page holding the 64 byte
+ * bank followed by a header page holding a sequence number and a CRC of
+ * the data and sequence number. A commit erases the inactive slot, programs
+ * the data page and finally the header page. The header program is the
+ * commit point: until it completes the slot fails validation and the other
+ * slot (the previous contents) is used.
+ *
+ * Once a commit has completed the previous contents are no longer needed,
+ * so eeprom_ab_idle() erases the inactive slot ahead of time and the next
+ * commit only pays program time.
+ *
+ * At mount the two headers are checked and the valid slot with the higher
+ * sequence number becomes active.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "crc.h"
+#include "eeprom_ab.h"
+#include "iap_driver.h"
+#include "iap_stats.h"
+
+struct eeprom_ab_header {
+	uint32_t seq;
+	uint16_t crc;
+	uint16_t reserved;
+};
+
+struct eeprom_ab_slot {
+	uint8_t data[EEPROM_AB_SIZE];
+	struct eeprom_ab_header header;
+	uint8_t pad[FLASH_PAGE_SIZE - sizeof(struct eeprom_ab_header)];
+};
+
+// Two slots of two pages each. Must be 64 byte aligned and start erased.
+static const uint8_t eeprom_ab_region[2 * sizeof(struct eeprom_ab_slot)]
+	FLASH_STORAGE
+	= FLASH_ERASED_INIT(2 * sizeof(struct eeprom_ab_slot));
+
+#define AB_SLOT(i) ((const struct eeprom_ab_slot *)(FLASH_CONTENTS(eeprom_ab_region) + (i) * sizeof(struct eeprom_ab_slot)))
+
+// Contents of bank before the first commit
+static const uint8_t eeprom_ab_empty[EEPROM_AB_SIZE] = {0};
+
+// Active slot (-1 if none) and its sequence number
+static int32_t active = -1;
+static uint32_t active_seq;
+
+static uint16_t slot_crc(const uint8_t *data, uint32_t seq) {
+	uint16_t crc = crc16(data, EEPROM_AB_SIZE);
+	return crc16_update(crc, (const uint8_t *)&seq, sizeof(seq));
+}
+
+static int slot_is_valid(const struct eeprom_ab_slot *s) {
+	return s->header.seq != 0xFFFFFFFF
+			&& s->header.crc == slot_crc(s->data, s->header.seq);
+}
+
+/**
+ * Select the newest valid copy of the bank. Must be called before any
+ * other eeprom_ab function.
+ *
+ * @return 0 for success.
+ */
+int32_t eeprom_ab_mount(void) {
+	int i;
+
+	active = -1;
+	active_seq = 0;
+	for (i = 0; i < 2; i++) {
+		const struct eeprom_ab_slot *s = AB_SLOT(i);
+		if ( ! slot_is_valid(s)) continue;
+		if (active < 0 || (int32_t)(s->header.seq - active_seq) > 0) {
+			active = i;
+			active_seq = s->header.seq;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Erase both copies, leaving an empty (all zero) bank.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_ab_format(void) {
+	int32_t status = flash_format(eeprom_ab_region, sizeof(eeprom_ab_region));
+	eeprom_ab_mount();
+	return status;
+}
+
+/**
+ * @return Pointer to the current 64 byte bank in flash.
+ */
+const uint8_t *eeprom_ab_data(void) {
+	return (active < 0) ? eeprom_ab_empty : AB_SLOT(active)->data;
+}
+
+/**
+ * @return Sequence number of the current bank (0 if never written).
+ */
+uint32_t eeprom_ab_seq(void) {
+	return active_seq;
+}
+
+static int slot_is_blank(const struct eeprom_ab_slot *s) {
+	return flash_is_blank(s, sizeof(struct eeprom_ab_slot));
+}
+
+static int32_t slot_erase(const struct eeprom_ab_slot *s) {
+	return flash_erase_pages(FLASH_PAGE_OF(s->data), FLASH_PAGE_OF(&s->header));
+}
+
+/*
+ * Write data and header to the inactive slot
+ */
+static int32_t slot_write(uint8_t *data) {
+	struct eeprom_ab_header header[FLASH_PAGE_SIZE / sizeof(struct eeprom_ab_header)]
+		__attribute__ ((aligned (4)));
+	uint32_t target = (active < 0) ? 0 : 1 - active;
+	const struct eeprom_ab_slot *s = AB_SLOT(target);
+	int32_t status;
+
+	// Slot not erased yet by eeprom_ab_idle()
+	if ( ! slot_is_blank(s)) {
+		status = slot_erase(s);
+		if (status != 0) return status;
+	}
+
+	status = flash_program_page(s->data, data);
+	if (status != 0) return status;
+
+	// Don't commit a copy that doesn't read back (slot was blank, so
+	// the page must now hold exactly data)
+	status = flash_verify(s->data, data, EEPROM_AB_SIZE, 0);
+	if (status != 0) return status;
+
+	memset(header, FLASH_ERASED_BYTE, sizeof(header));
+	header[0].seq = active_seq + 1;
+	header[0].crc = slot_crc(data, header[0].seq);
+	status = flash_program_page(&s->header, (uint8_t *)header);
+	if (status != 0) return status;
+
+	active = target;
+	active_seq = header[0].seq;
+
+	return 0;
+}
+
+/**
+ * Commit a new bank image to the inactive slot. The latency of commits
+ * that write flash is recorded as IAP_OP_COMMIT in iap_stats.
+ *
+ * @param data Pointer to 64 byte image. Must be word aligned and in SRAM.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_ab_commit(uint8_t *data) {
+	uint32_t start;
+	int32_t status;
+
+	if (memcmp(data, eeprom_ab_data(), EEPROM_AB_SIZE) == 0) {
+		return 0;
+	}
+
+	start = iap_ticks();
+	status = slot_write(data);
+	iap_stats_record(IAP_OP_COMMIT, iap_ticks() - start, status);
+
+	return status;
+}
+
+/**
+ * Erase the inactive slot if it isn't already, so that the next commit
+ * needs no erase. Call when there is nothing else to do: an erase takes
+ * ~100ms.
+ *
+ * @return 0 for success (or nothing to do), negative value for error.
+ */
+int32_t eeprom_ab_idle(void) {
+	const struct eeprom_ab_slot *s;
+
+	// Keep the only copy until there is a newer one
+	if (active < 0) return 0;
+
+	s = AB_SLOT(1 - active);
+	if (slot_is_blank(s)) return 0;
+	return slot_erase(s);
+}
@@ -0,0 +1,23 @@
+/*
+ * eeprom_ab.h
+ *
+ * Power-fail safe 'EEPROM' bank using two copies (A and B) in flash. Each
+ * commit is written to the inactive copy with a sequence number and CRC,
+ * so an interrupted commit always leaves the previous contents intact.
+ */
+
+#ifndef EEPROM_AB_H_
+#define EEPROM_AB_H_
+
+#include <stdint.h>
+
+#define EEPROM_AB_SIZE (64)
+
+int32_t eeprom_ab_mount(void);
+int32_t eeprom_ab_format(void);
+const uint8_t *eeprom_ab_data(void);
+uint32_t eeprom_ab_seq(void);
+int32_t eeprom_ab_commit(uint8_t *data);
+int32_t eeprom_ab_idle(void);
+
+#endif /* EEPROM_AB_H_ */
@@ -0,0 +1,67 @@
+/*
+ * eeprom_bank.c
+ *
+ * Write path for named 'EEPROM' banks. A write only goes to the pages of
+ * its own bank that it touches, and each page is written the cheapest way
+ * (skipped if unchanged, programmed without erase if only bits are
+ * cleared, see flash_write_page()).
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_bank.h"
+
+/**
+ * @return Pointer to the contents of a bank in flash.
+ */
+const uint8_t *eeprom_bank_data(const struct eeprom_bank *bank) {
+	return FLASH_CONTENTS(bank->flash);
+}
+
+/**
+ * Write bytes to a bank.
+ *
+ * @param bank Bank declared with EEPROM_BANK()
+ * @param offset Offset in bank of first byte
+ * @param data Bytes to write (any alignment, may be in flash)
+ * @param len Number of bytes
+ *
+ * @return 0 for success, -1 if outside the bank, other negative value
+ * for error.
+ */
+int32_t eeprom_bank_write(const struct eeprom_bank *bank, uint32_t offset,
+		const uint8_t *data, uint32_t len) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	const uint8_t *page;
+	uint32_t start, n;
+	int32_t status;
+
+	if (offset > bank->size || len > bank->size - offset) return -1;
+
+	while (len > 0) {
+		page = eeprom_bank_data(bank) + (offset & ~(FLASH_PAGE_SIZE - 1));
+		start = offset % FLASH_PAGE_SIZE;
+		n = FLASH_PAGE_SIZE - start;
+		if (n > len) n = len;
+
+		memcpy(buf, page, FLASH_PAGE_SIZE);
+		memcpy(buf + start, data, n);
+		status = flash_write_page(page, buf);
+		if (status != 0) return status;
+
+		offset += n;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Erase a bank.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_bank_format(const struct eeprom_bank *bank) {
+	return flash_format(bank->flash, bank->size);
+}
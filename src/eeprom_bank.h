@@ -0,0 +1,43 @@
+/*
+ * eeprom_bank.h
+ *
+ * Named 'EEPROM' banks of any multiple of 64 bytes, each in flash pages of
+ * its own (and sector aligned if a sector or more), so that writing one
+ * bank never rewrites another. Declare a bank at file scope with
+ *
+ *   EEPROM_BANK(config_bank, 128);
+ *
+ * and use it through &config_bank. Placement is left to the linker: the
+ * flash is put in the Flash region's read only data (cr_section_macros.h).
+ */
+
+#ifndef EEPROM_BANK_H_
+#define EEPROM_BANK_H_
+
+#include <stdint.h>
+#include <cr_section_macros.h>
+
+#include "flash.h"
+
+struct eeprom_bank {
+	const char *name;
+	const uint8_t *flash;
+	uint32_t size;
+};
+
+// Banks of a sector or more start on a sector boundary, others on a page
+#define EEPROM_BANK_ALIGN(size) (((size) >= FLASH_SECTOR_SIZE) ? FLASH_SECTOR_SIZE : FLASH_PAGE_SIZE)
+
+#define EEPROM_BANK(name, size) \
+	_Static_assert((size) > 0 && (size) % FLASH_PAGE_SIZE == 0, \
+			#name " size must be a multiple of 64 bytes"); \
+	static const uint8_t name##_flash[size] __RODATA(Flash) FLASH_STORAGE \
+		__attribute__ ((aligned (EEPROM_BANK_ALIGN(size)))) = FLASH_ERASED_INIT(size); \
+	const struct eeprom_bank name = { #name, name##_flash, size }
+
+const uint8_t *eeprom_bank_data(const struct eeprom_bank *bank);
+int32_t eeprom_bank_write(const struct eeprom_bank *bank, uint32_t offset,
+		const uint8_t *data, uint32_t len);
+int32_t eeprom_bank_format(const struct eeprom_bank *bank);
+
+#endif /* EEPROM_BANK_H_ */
@@ -0,0 +1,178 @@
+/*
+ * eeprom_cache.c
+ *
+ * Write-back SRAM cache for the 64 byte 'EEPROM' bank.
+ *
+ * A bitmap records which bytes of the SRAM image differ from flash. A write
+ * that sets a byte back to its flash value clears its dirty bit, so writes
+ * that leave the bank unchanged never cause a flash commit.
+ *
+ * The erase budget is a token bucket kept in milliseconds: it fills at one
+ * commit's worth every 3600000 / EEPROM_CACHE_ERASES_PER_HOUR ms up to
+ * EEPROM_CACHE_ERASE_BURST commits and every commit takes one commit's
+ * worth out, so a write storm costs no more than the budget. Forced
+ * flushes (F, reboot) are always made and can take the budget negative.
+ */
+
+#include <string.h>
+
+#include "systick.h"
+#include "eeprom_cache.h"
+
+struct eeprom_cache_stats eeprom_cache_stats;
+
+// SRAM image of bank. Word aligned as required by IAP copy.
+static uint8_t image[EEPROM_CACHE_SIZE] __attribute__ ((aligned (4)));
+
+// One bit per byte of bank: set if image differs from flash
+static uint32_t dirty[EEPROM_CACHE_SIZE / 32];
+
+static eeprom_source_fn source_fn;
+static eeprom_commit_fn commit_fn;
+static uint32_t last_write_ms;
+
+#if EEPROM_CACHE_ERASES_PER_HOUR > 0
+#define COMMIT_COST_MS (3600000 / EEPROM_CACHE_ERASES_PER_HOUR)
+
+// Erase budget in ms of commit rate and when it was last topped up
+static int32_t budget_ms;
+static uint32_t budget_time;
+
+/*
+ * Top up the erase budget for the time since the last call.
+ *
+ * @return 1 if a commit is within budget
+ */
+static int budget_available(void) {
+	uint32_t now = systick_now();
+	uint32_t elapsed = now - budget_time;
+	// Room left in the bucket (budget_ms never exceeds the burst size)
+	uint32_t room = (uint32_t)(EEPROM_CACHE_ERASE_BURST * COMMIT_COST_MS) - (uint32_t)budget_ms;
+
+	// Clamp before adding: a long idle time would overflow budget_ms
+	if (elapsed >= room) {
+		budget_ms = EEPROM_CACHE_ERASE_BURST * COMMIT_COST_MS;
+	} else {
+		budget_ms += (int32_t)elapsed;
+	}
+	budget_time = now;
+	return budget_ms >= COMMIT_COST_MS;
+}
+#endif
+
+static int any_dirty(void) {
+	uint32_t i;
+	for (i = 0; i < EEPROM_CACHE_SIZE / 32; i++) {
+		if (dirty[i]) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Load the cache from the flash bank.
+ *
+ * @param source Function returning the bank in flash. The bank may move
+ * after a commit (eg when double buffered).
+ * @param commit Function that writes a 64 byte SRAM image to the bank
+ */
+void eeprom_cache_init(eeprom_source_fn source, eeprom_commit_fn commit) {
+	source_fn = source;
+	commit_fn = commit;
+	memcpy(image, source(), EEPROM_CACHE_SIZE);
+	memset(dirty, 0, sizeof(dirty));
+#if EEPROM_CACHE_ERASES_PER_HOUR > 0
+	budget_ms = EEPROM_CACHE_ERASE_BURST * COMMIT_COST_MS;
+	budget_time = systick_now();
+#endif
+}
+
+/**
+ * @return Pointer to the SRAM image of the bank (including staged writes).
+ */
+const uint8_t *eeprom_cache_image(void) {
+	return image;
+}
+
+/**
+ * Stage a byte write. Does not touch flash.
+ *
+ * @param addr Index in bank (0 to EEPROM_CACHE_SIZE-1)
+ * @param val Byte value
+ */
+void eeprom_cache_write(uint32_t addr, uint8_t val) {
+	uint32_t bit = 1 << (addr & 31);
+
+	if (addr >= EEPROM_CACHE_SIZE) return;
+
+	eeprom_cache_stats.writes++;
+	if (image[addr] == val) {
+		eeprom_cache_stats.absorbed++;
+		return;
+	}
+
+	image[addr] = val;
+	if (source_fn()[addr] == val) {
+		dirty[addr >> 5] &= ~bit;
+	} else {
+		dirty[addr >> 5] |= bit;
+	}
+	last_write_ms = systick_now();
+
+#if EEPROM_CACHE_ERASES_PER_HOUR > 0
+	if ( ! budget_available()) {
+		eeprom_cache_stats.throttled++;
+	}
+#endif
+}
+
+/**
+ * @return Number of bytes in the SRAM image that differ from flash.
+ */
+uint32_t eeprom_cache_dirty_count(void) {
+	uint32_t i, n = 0;
+	for (i = 0; i < EEPROM_CACHE_SIZE; i++) {
+		if (dirty[i >> 5] & (1 << (i & 31))) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+ * Commit staged writes to flash. Does nothing if no byte is dirty.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_cache_flush(void) {
+	int32_t status;
+
+	if ( ! any_dirty()) return 0;
+
+	eeprom_cache_stats.commits++;
+#if EEPROM_CACHE_ERASES_PER_HOUR > 0
+	budget_available();
+	budget_ms -= COMMIT_COST_MS;
+#endif
+	status = commit_fn(image);
+	if (status == 0) {
+		memset(dirty, 0, sizeof(dirty));
+	}
+	return status;
+}
+
+/**
+ * Call periodically while idle. Commits staged writes once no write has
+ * occurred for EEPROM_CACHE_IDLE_MS or, with an erase budget, as soon as
+ * the budget allows (the idle timeout is then not used).
+ *
+ * @return 0 for success or nothing to do, negative value for error.
+ */
+int32_t eeprom_cache_idle(void) {
+	if ( ! any_dirty()) return 0;
+#if EEPROM_CACHE_ERASES_PER_HOUR > 0
+	if ( ! budget_available()) return 0;
+#else
+	if (systick_now() - last_write_ms < EEPROM_CACHE_IDLE_MS) return 0;
+#endif
+	return eeprom_cache_flush();
+}
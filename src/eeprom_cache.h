@@ -0,0 +1,59 @@
+/*
+ * eeprom_cache.h
+ *
+ * Write-back SRAM cache for the 64 byte 'EEPROM' bank. Byte writes are
+ * staged in SRAM and committed to flash in one operation on an explicit
+ * flush, after an idle timeout or before reboot. Optionally an erase
+ * budget lets writes be committed as soon as they are made for as long as
+ * the write rate stays within the budget.
+ */
+
+#ifndef EEPROM_CACHE_H_
+#define EEPROM_CACHE_H_
+
+#include <stdint.h>
+
+#define EEPROM_CACHE_SIZE (64)
+
+// Commit staged writes once no write has occurred for this long
+#ifndef EEPROM_CACHE_IDLE_MS
+#define EEPROM_CACHE_IDLE_MS (2000)
+#endif
+
+// Erase budget (commits per hour). While within budget staged writes are
+// committed at the next idle call instead of waiting for the idle timeout;
+// writes beyond it stay in SRAM and are coalesced into the next commit the
+// budget allows. Every commit is counted as an erase of the bank. 0 turns
+// the budget off.
+#ifndef EEPROM_CACHE_ERASES_PER_HOUR
+#define EEPROM_CACHE_ERASES_PER_HOUR (0)
+#endif
+
+// Commits that can be made back to back when budget has built up
+#ifndef EEPROM_CACHE_ERASE_BURST
+#define EEPROM_CACHE_ERASE_BURST (4)
+#endif
+
+// Function returning the 64 byte bank currently in flash
+typedef const uint8_t *(*eeprom_source_fn)(void);
+
+// Function used to commit a 64 byte SRAM image to flash (eg eeprom_write())
+typedef int32_t (*eeprom_commit_fn)(uint8_t *data);
+
+struct eeprom_cache_stats {
+	uint32_t writes;	// byte writes requested
+	uint32_t absorbed;	// byte writes that left the bank unchanged
+	uint32_t commits;	// flash commits
+	uint32_t throttled;	// byte writes made while out of erase budget
+};
+
+extern struct eeprom_cache_stats eeprom_cache_stats;
+
+void eeprom_cache_init(eeprom_source_fn source, eeprom_commit_fn commit);
+const uint8_t *eeprom_cache_image(void);
+void eeprom_cache_write(uint32_t addr, uint8_t val);
+uint32_t eeprom_cache_dirty_count(void);
+int32_t eeprom_cache_flush(void);
+int32_t eeprom_cache_idle(void);
+
+#endif /* EEPROM_CACHE_H_ */
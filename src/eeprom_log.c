@@ -0,0 +1,300 @@
+/*
+ * eeprom_log.c
+ *
+ * Log structured 'EEPROM' bank.
+ *
+ * The region is used as a circular sequence of 64 byte pages. Each page
+ * starts with a header holding a 16 bit sequence number (and its
+ * complement) followed by 15 four byte records of {addr, val, ~addr, ~val}.
+ * A write programs one fresh record slot (all other bytes of the page image
+ * are 0xFF so existing records are left untouched). The EEPROM_LOG_SPARES
+ * pages following the head page are spares, kept erased. When the head page
+ * fills, the next page becomes the head and the oldest page is retired: any
+ * of its records that have not been superseded by a newer page are carried
+ * forward into the new head page, and the retired page becomes the last
+ * spare. Retired pages are erased by eeprom_log_idle(), so a write normally
+ * only pays program time; a spare still not erased when it is needed is
+ * erased by the write. A power failure at any point leaves the region in a
+ * state that replays to either the old or the new contents (a retired page
+ * replays first, and everything in it is superseded).
+ *
+ * At mount, the page with the highest sequence number is the head and the
+ * bank image is rebuilt in SRAM by replaying pages from oldest to newest.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "eeprom_log.h"
+#include "iap_driver.h"
+#include "iap_stats.h"
+
+#if EEPROM_LOG_PAGES < 6
+#error "EEPROM_LOG_PAGES must be at least 6"
+#endif
+
+#if EEPROM_LOG_SPARES < 1 || EEPROM_LOG_SPARES > EEPROM_LOG_PAGES - 5
+#error "EEPROM_LOG_SPARES must be from 1 to EEPROM_LOG_PAGES - 5"
+#endif
+
+struct eeprom_log_record {
+	uint8_t addr;
+	uint8_t val;
+	uint8_t addr_inv;
+	uint8_t val_inv;
+};
+
+struct eeprom_log_page {
+	uint16_t seq;
+	uint16_t seq_inv;
+	struct eeprom_log_record rec[EEPROM_LOG_SLOTS];
+};
+
+// Flash region used for the log. Must be 64 byte aligned and start erased.
+static const uint8_t eeprom_log_region[EEPROM_LOG_PAGES * FLASH_PAGE_SIZE]
+	FLASH_STORAGE
+	= FLASH_ERASED_INIT(EEPROM_LOG_PAGES * FLASH_PAGE_SIZE);
+
+#define LOG_PAGE(i) ((const struct eeprom_log_page *)(FLASH_CONTENTS(eeprom_log_region) + (i) * FLASH_PAGE_SIZE))
+
+struct eeprom_log_stats eeprom_log_stats;
+
+// SRAM copy of the logical bank
+static uint8_t image[EEPROM_LOG_BANK_SIZE];
+
+// Head page index (-1 if region is empty), next free slot and sequence number
+static int32_t head = -1;
+static uint32_t head_slot;
+static uint16_t head_seq;
+
+static int page_is_valid(const struct eeprom_log_page *p) {
+	return p->seq_inv == (uint16_t)~p->seq;
+}
+
+static int record_is_valid(const struct eeprom_log_record *r) {
+	return r->addr < EEPROM_LOG_BANK_SIZE
+			&& r->addr_inv == (uint8_t)~r->addr
+			&& r->val_inv == (uint8_t)~r->val;
+}
+
+static int record_is_blank(const struct eeprom_log_record *r) {
+	return *(const uint32_t *)r == 0xFFFFFFFF;
+}
+
+static void record_set(struct eeprom_log_record *r, uint8_t addr, uint8_t val) {
+	r->addr = addr;
+	r->val = val;
+	r->addr_inv = ~addr;
+	r->val_inv = ~val;
+}
+
+static int32_t page_program(uint32_t i, struct eeprom_log_page *buf) {
+	eeprom_log_stats.programs++;
+	return flash_program_page(LOG_PAGE(i), (uint8_t *)buf);
+}
+
+static int32_t page_erase(uint32_t i) {
+	uint32_t page = FLASH_PAGE_OF(LOG_PAGE(i));
+	eeprom_log_stats.erases++;
+	return flash_erase_pages(page, page);
+}
+
+static int page_is_blank(uint32_t i) {
+	return flash_is_blank(LOG_PAGE(i), FLASH_PAGE_SIZE);
+}
+
+/**
+ * Move the head to the next (spare) page, carrying forward the live
+ * records of the oldest page, which is retired to become a spare.
+ */
+static int32_t rotate(void) {
+	struct eeprom_log_page buf __attribute__ ((aligned (4)));
+	uint32_t next = (head < 0) ? 0 : (head + 1) % EEPROM_LOG_PAGES;
+	uint32_t oldest = (next + EEPROM_LOG_SPARES) % EEPROM_LOG_PAGES;
+	uint32_t newer[2] = {0, 0}, carried[2] = {0, 0};
+	uint32_t i, j, n = 0;
+	int32_t status;
+
+	memset(&buf, FLASH_ERASED_BYTE, sizeof(buf));
+	buf.seq = head_seq + 1;
+	buf.seq_inv = ~buf.seq;
+
+	const struct eeprom_log_page *op = LOG_PAGE(oldest);
+	if (head >= 0 && page_is_valid(op)) {
+
+		// Addresses written in pages newer than the oldest
+		for (i = (oldest + 1) % EEPROM_LOG_PAGES; i != next; i = (i + 1) % EEPROM_LOG_PAGES) {
+			const struct eeprom_log_page *p = LOG_PAGE(i);
+			if ( ! page_is_valid(p)) continue;
+			for (j = 0; j < EEPROM_LOG_SLOTS; j++) {
+				if (record_is_valid(&p->rec[j])) {
+					newer[p->rec[j].addr >> 5] |= 1 << (p->rec[j].addr & 31);
+				}
+			}
+		}
+
+		// Carry forward the current value of any address only written in the oldest page
+		for (j = 0; j < EEPROM_LOG_SLOTS; j++) {
+			const struct eeprom_log_record *r = &op->rec[j];
+			if ( ! record_is_valid(r)) continue;
+			uint32_t w = r->addr >> 5, bit = 1 << (r->addr & 31);
+			if ((newer[w] | carried[w]) & bit) continue;
+			carried[w] |= bit;
+			record_set(&buf.rec[n++], r->addr, image[r->addr]);
+		}
+	}
+
+	// Spare not erased yet by eeprom_log_idle()
+	if ( ! page_is_blank(next)) {
+		eeprom_log_stats.foreground_erases++;
+		status = page_erase(next);
+		if (status != 0) return status;
+	}
+
+	status = page_program(next, &buf);
+	if (status != 0) return status;
+
+	head = next;
+	head_slot = n;
+	head_seq = buf.seq;
+
+	return 0;
+}
+
+/**
+ * Scan the log region and rebuild the bank image in SRAM. Must be called
+ * before any other eeprom_log function.
+ *
+ * @return 0 for success.
+ */
+int32_t eeprom_log_mount(void) {
+	uint32_t i, j;
+
+	memset(image, 0, sizeof(image));
+	head = -1;
+	head_slot = 0;
+	head_seq = 0;
+
+	// Find head: the valid page with the highest sequence number (serial
+	// number arithmetic so that wrap around of the 16 bit counter is handled)
+	for (i = 0; i < EEPROM_LOG_PAGES; i++) {
+		const struct eeprom_log_page *p = LOG_PAGE(i);
+		if ( ! page_is_valid(p)) continue;
+		if (head < 0 || (int16_t)(p->seq - head_seq) > 0) {
+			head = i;
+			head_seq = p->seq;
+		}
+	}
+
+	if (head < 0) {
+		return 0;
+	}
+
+	// Replay from the page after the head (oldest) around to the head
+	for (i = 1; i <= EEPROM_LOG_PAGES; i++) {
+		const struct eeprom_log_page *p = LOG_PAGE((head + i) % EEPROM_LOG_PAGES);
+		if ( ! page_is_valid(p)) continue;
+		for (j = 0; j < EEPROM_LOG_SLOTS; j++) {
+			if (record_is_valid(&p->rec[j])) {
+				image[p->rec[j].addr] = p->rec[j].val;
+			}
+		}
+	}
+
+	// Next free slot follows the last slot in the head page that is not blank
+	const struct eeprom_log_page *hp = LOG_PAGE(head);
+	head_slot = EEPROM_LOG_SLOTS;
+	while (head_slot > 0 && record_is_blank(&hp->rec[head_slot - 1])) {
+		head_slot--;
+	}
+
+	return 0;
+}
+
+/**
+ * Erase the whole log region, leaving an empty (all zero) bank.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_log_format(void) {
+	int32_t status = flash_format(eeprom_log_region, sizeof(eeprom_log_region));
+	eeprom_log_mount();
+	return status;
+}
+
+/**
+ * @return Pointer to the SRAM image of the bank.
+ */
+const uint8_t *eeprom_log_image(void) {
+	return image;
+}
+
+/*
+ * Append a record to the head page, rotating first if it is full
+ */
+static int32_t append(uint32_t addr, uint8_t val) {
+	struct eeprom_log_page buf __attribute__ ((aligned (4)));
+	int32_t status;
+
+	// Rotating can fill the new head with carried records, so loop
+	while (head < 0 || head_slot == EEPROM_LOG_SLOTS) {
+		status = rotate();
+		if (status != 0) return status;
+	}
+
+	memset(&buf, FLASH_ERASED_BYTE, sizeof(buf));
+	record_set(&buf.rec[head_slot], addr, val);
+	status = page_program(head, &buf);
+	if (status != 0) return status;
+
+	head_slot++;
+	image[addr] = val;
+
+	return 0;
+}
+
+/**
+ * Write one byte of the bank. Writing a value equal to the current
+ * value does not touch flash. The latency of writes that do is recorded
+ * as IAP_OP_COMMIT in iap_stats.
+ *
+ * @param addr Index in bank (0 to EEPROM_LOG_BANK_SIZE-1)
+ * @param val Byte value
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t eeprom_log_write(uint32_t addr, uint8_t val) {
+	uint32_t start;
+	int32_t status;
+
+	if (addr >= EEPROM_LOG_BANK_SIZE) return -1;
+	if (image[addr] == val) return 0;
+
+	eeprom_log_stats.writes++;
+
+	start = iap_ticks();
+	status = append(addr, val);
+	iap_stats_record(IAP_OP_COMMIT, iap_ticks() - start, status);
+
+	return status;
+}
+
+/**
+ * Erase one retired spare page, if any. Call when there is nothing else
+ * to do: an erase takes ~100ms.
+ *
+ * @return 0 for success (or nothing to do), negative value for error.
+ */
+int32_t eeprom_log_idle(void) {
+	uint32_t i, p;
+
+	if (head < 0) return 0;
+
+	for (i = 1; i <= EEPROM_LOG_SPARES; i++) {
+		p = (head + i) % EEPROM_LOG_PAGES;
+		if ( ! page_is_blank(p)) {
+			return page_erase(p);
+		}
+	}
+	return 0;
+}
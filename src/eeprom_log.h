@@ -0,0 +1,50 @@
+/*
+ * eeprom_log.h
+ *
+ * Log structured 'EEPROM' bank. Instead of erasing and rewriting the bank
+ * page on every change, each byte write appends a small record to the next
+ * free slot of a multi-page flash region. A page is only erased when the
+ * region wraps around and the page is recycled.
+ */
+
+#ifndef EEPROM_LOG_H_
+#define EEPROM_LOG_H_
+
+#include <stdint.h>
+
+// Number of bytes in the logical bank
+#define EEPROM_LOG_BANK_SIZE (64)
+
+// Number of 64 byte flash pages in the log region. Must be at least 6 so
+// that the live contents of the bank always fit in the region with room
+// to spare. Reduce to 6 on the LPC810 if flash is tight.
+#ifndef EEPROM_LOG_PAGES
+#define EEPROM_LOG_PAGES (8)
+#endif
+
+// Number of pages after the head kept erased ready for the next rotations.
+// Retired pages are erased by eeprom_log_idle() so that a write only pays
+// program time. At least 1 and at most EEPROM_LOG_PAGES - 5.
+#ifndef EEPROM_LOG_SPARES
+#define EEPROM_LOG_SPARES (1)
+#endif
+
+// Records per page (first slot of each page is used for the page header)
+#define EEPROM_LOG_SLOTS (15)
+
+struct eeprom_log_stats {
+	uint32_t writes;	// logical byte writes that changed the bank
+	uint32_t programs;	// page program operations
+	uint32_t erases;	// page erase operations
+	uint32_t foreground_erases;	// of which done by a write (spare not ready)
+};
+
+extern struct eeprom_log_stats eeprom_log_stats;
+
+int32_t eeprom_log_mount(void);
+int32_t eeprom_log_format(void);
+const uint8_t *eeprom_log_image(void);
+int32_t eeprom_log_write(uint32_t addr, uint8_t val);
+int32_t eeprom_log_idle(void);
+
+#endif /* EEPROM_LOG_H_ */
@@ -0,0 +1,84 @@
+/*
+ * eeprom_txn.c
+ *
+ * Transactions on the 'EEPROM' bank. The transaction works on an SRAM copy
+ * of the bank taken at eeprom_txn_begin(), so a commit is a single write
+ * of the bank, which is atomic when the bank is double buffered
+ * (eeprom_ab.c).
+ */
+
+#include <string.h>
+
+#include "eeprom_txn.h"
+
+struct eeprom_txn_stats eeprom_txn_stats;
+
+// SRAM image of bank being built. Word aligned as required by IAP copy.
+static uint8_t image[EEPROM_TXN_SIZE] __attribute__ ((aligned (4)));
+
+static int open;
+static uint32_t writes;
+
+/**
+ * Start a transaction.
+ *
+ * @param current Current contents of the bank (eg eeprom_read())
+ *
+ * @return 0 for success, -1 if a transaction is already open.
+ */
+int32_t eeprom_txn_begin(const uint8_t *current) {
+	if (open) return -1;
+	memcpy(image, current, EEPROM_TXN_SIZE);
+	writes = 0;
+	open = 1;
+	return 0;
+}
+
+/**
+ * @return 1 if a transaction is open, 0 otherwise.
+ */
+int eeprom_txn_is_open(void) {
+	return open;
+}
+
+/**
+ * Stage a byte write in the open transaction. Does not touch flash.
+ *
+ * @param addr Index in bank (0 to EEPROM_TXN_SIZE-1)
+ * @param val Byte value
+ *
+ * @return 0 for success, -1 if no transaction is open or addr is out of
+ * range.
+ */
+int32_t eeprom_txn_write(uint32_t addr, uint8_t val) {
+	if ( ! open || addr >= EEPROM_TXN_SIZE) return -1;
+	image[addr] = val;
+	writes++;
+	return 0;
+}
+
+/**
+ * Apply the staged writes with one commit and close the transaction. The
+ * transaction is closed even if the commit fails.
+ *
+ * @param commit Function that writes the 64 byte image to the bank
+ *
+ * @return 0 for success, -1 if no transaction is open, other negative
+ * value for commit error.
+ */
+int32_t eeprom_txn_commit(eeprom_txn_commit_fn commit) {
+	if ( ! open) return -1;
+	open = 0;
+	eeprom_txn_stats.commits++;
+	eeprom_txn_stats.writes += writes;
+	return commit(image);
+}
+
+/**
+ * Drop the staged writes and close the transaction.
+ */
+void eeprom_txn_abort(void) {
+	if ( ! open) return;
+	open = 0;
+	eeprom_txn_stats.aborts++;
+}
@@ -0,0 +1,35 @@
+/*
+ * eeprom_txn.h
+ *
+ * Transactions on the 64 byte 'EEPROM' bank: any number of byte writes
+ * are staged in SRAM between eeprom_txn_begin() and eeprom_txn_commit(),
+ * then applied with one commit of the whole bank image, or dropped with
+ * eeprom_txn_abort().
+ */
+
+#ifndef EEPROM_TXN_H_
+#define EEPROM_TXN_H_
+
+#include <stdint.h>
+
+#define EEPROM_TXN_SIZE (64)
+
+// Function used to commit a 64 byte SRAM image of the bank (eg
+// eeprom_commit_image())
+typedef int32_t (*eeprom_txn_commit_fn)(uint8_t *image);
+
+struct eeprom_txn_stats {
+	uint32_t commits;
+	uint32_t aborts;
+	uint32_t writes;	// byte writes staged in committed transactions
+};
+
+extern struct eeprom_txn_stats eeprom_txn_stats;
+
+int32_t eeprom_txn_begin(const uint8_t *current);
+int eeprom_txn_is_open(void);
+int32_t eeprom_txn_write(uint32_t addr, uint8_t val);
+int32_t eeprom_txn_commit(eeprom_txn_commit_fn commit);
+void eeprom_txn_abort(void);
+
+#endif /* EEPROM_TXN_H_ */
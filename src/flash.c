@@ -0,0 +1,370 @@
+/*
+ * flash.c
+ *
+ * Page level helpers for writing to the LPC8xx flash from the application.
+ * Each IAP erase or copy must be preceded by a prepare of the sector(s)
+ * involved: the ROM re-protects the sectors after every successful
+ * erase / copy.
+ */
+
+#include "flash.h"
+#include "crc.h"
+#include "iap_driver.h"
+#include "iap_stats.h"
+
+struct flash_write_stats flash_write_stats;
+struct flash_verify_stats flash_verify_stats;
+uint32_t flash_verify_mode = FLASH_VERIFY;
+
+static flash_erase_hook_fn erase_hook = 0;
+
+/**
+ * Set function to be called after every successful erase (eg to count
+ * wear). Erases done by the hook itself are also reported to it.
+ */
+void flash_set_erase_hook(flash_erase_hook_fn hook) {
+	erase_hook = hook;
+}
+
+/**
+ * Erase a range of flash pages.
+ *
+ * @param page_start First page to erase
+ * @param page_end Last page to erase (inclusive)
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t flash_erase_pages(uint32_t page_start, uint32_t page_end) {
+
+	uint32_t sector_start = page_start / FLASH_PAGES_PER_SECTOR;
+	uint32_t sector_end = page_end / FLASH_PAGES_PER_SECTOR;
+
+	iap_init();
+
+	/* Prepare the sector(s) for erase */
+	if (iap_prepare_sector(sector_start, sector_end) != CMD_SUCCESS) return -4;
+
+	/* Erase the page(s) */
+	if (iap_erase_page(page_start, page_end) != CMD_SUCCESS) return -5;
+
+	if (erase_hook) {
+		erase_hook(page_start, page_end);
+	}
+
+	return 0;
+}
+
+/**
+ * Program a 64 byte page without erasing it first. Programming can only
+ * change bits from 1 to 0 so bytes that are to be left untouched should be
+ * 0xFF in data.
+ *
+ * @param flash_page Address of 64 byte aligned page in flash.
+ * @param data Pointer to 64 bytes to write. This address *must* be word
+ * aligned and in SRAM.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t flash_program_page(const void *flash_page, uint8_t *data) {
+
+	uint32_t flash_sector = FLASH_SECTOR_OF(flash_page);
+
+	iap_init();
+
+	/* Prepare the page for writing */
+	if (iap_prepare_sector(flash_sector, flash_sector) != CMD_SUCCESS) return -6;
+
+	/* Write data to page */
+	if (iap_copy_ram_to_flash(data, (void *)flash_page, FLASH_PAGE_SIZE)
+			!= CMD_SUCCESS) return -7;
+
+	return 0;
+}
+
+/**
+ * Compare new page contents with what is in flash to find the cheapest way
+ * to write it. No erase is needed if the page is unchanged or if every
+ * changed bit goes from 1 to 0.
+ *
+ * @param flash_page Address of 64 byte aligned page in flash.
+ * @param data Pointer to 64 byte (word aligned) new page contents.
+ *
+ * @return FLASH_WRITE_SKIP, FLASH_WRITE_PROGRAM or FLASH_WRITE_ERASE
+ */
+int flash_write_path(const void *flash_page, const uint8_t *data) {
+	const uint32_t *f = (const uint32_t *)flash_page;
+	const uint32_t *d = (const uint32_t *)data;
+	int path = FLASH_WRITE_SKIP;
+	int i;
+
+	for (i = 0; i < FLASH_PAGE_SIZE/4; i++) {
+		if (f[i] != d[i]) {
+			if ((f[i] & d[i]) != d[i]) {
+				// A bit needs to go from 0 to 1
+				return FLASH_WRITE_ERASE;
+			}
+			path = FLASH_WRITE_PROGRAM;
+		}
+	}
+	return path;
+}
+
+/**
+ * Write a 64 byte page, erasing it first only if necessary.
+ *
+ * @param flash_page Address of 64 byte aligned page in flash.
+ * @param data Pointer to 64 byte block of memory to write to flash.
+ * This address *must* be word aligned and in SRAM (writing from flash memory
+ * won't work, eg using const defined in the program as param won't work).
+ *
+ * @return 0 for success, -8 if verification is on and the page doesn't
+ * read back as data, other negative value for error.
+ */
+int32_t flash_write_page(const void *flash_page, uint8_t *data) {
+
+	uint32_t flash_page_no = FLASH_PAGE_OF(flash_page);
+	int32_t status;
+
+	// Example code checks MCU part ID, bootcode revision number and serial number. There are some
+	// differences in behavior across silicon revisions (in particular to do with ability
+	// to erase multiple sectors at the same time). In this case we require to be able to program
+	// just one sector, so this does not concern us.
+
+	switch (flash_write_path(flash_page, data)) {
+	case FLASH_WRITE_SKIP:
+		flash_write_stats.skip++;
+		return 0;
+	case FLASH_WRITE_PROGRAM:
+		flash_write_stats.program++;
+		break;
+	default:
+		flash_write_stats.erase++;
+		status = flash_erase_pages(flash_page_no, flash_page_no);
+		if (status != 0) return status;
+	}
+
+	status = flash_program_page(flash_page, data);
+	if (status != 0) return status;
+
+	return flash_verify(flash_page, data, FLASH_PAGE_SIZE, 0);
+}
+
+/**
+ * Write a region of whole pages. Rather than looping page by page this
+ * erases the whole region with one ranged page erase (only if needed) and
+ * then programs it with the largest copies the IAP allows (up to 1024
+ * bytes, aligned to their size so that a copy never spans a sector).
+ *
+ * @param flash_addr Address of 64 byte aligned region in flash.
+ * @param data Pointer to new contents. Must be word aligned and in SRAM.
+ * @param len Length of region in bytes. Must be a multiple of 64.
+ *
+ * @return 0 for success, -8 if verification is on and the region doesn't
+ * read back as data, other negative value for error.
+ */
+int32_t flash_write_bulk(const void *flash_addr, uint8_t *data, uint32_t len) {
+
+	uint32_t addr = (uint32_t)(uintptr_t)flash_addr;
+	uint32_t offset, size;
+	int path = FLASH_WRITE_SKIP, p;
+	int32_t status;
+
+	if ((addr % FLASH_PAGE_SIZE) != 0 || (len % FLASH_PAGE_SIZE) != 0) return -1;
+
+	for (offset = 0; offset < len; offset += FLASH_PAGE_SIZE) {
+		p = flash_write_path((const uint8_t *)flash_addr + offset, data + offset);
+		if (p > path) path = p;
+	}
+
+	switch (path) {
+	case FLASH_WRITE_SKIP:
+		flash_write_stats.skip++;
+		return 0;
+	case FLASH_WRITE_PROGRAM:
+		flash_write_stats.program++;
+		break;
+	default:
+		flash_write_stats.erase++;
+		status = flash_erase_pages(FLASH_PAGE_OF(addr), FLASH_PAGE_OF(addr + len - 1));
+		if (status != 0) return status;
+	}
+
+	iap_init();
+
+	for (offset = 0; offset < len; offset += size) {
+
+		// Largest legal copy that fits and is aligned to its own size
+		size = FLASH_COPY_MAX;
+		while (size > len - offset || ((addr + offset) % size) != 0) {
+			size >>= 1;
+		}
+
+		if (iap_prepare_sector(FLASH_SECTOR_OF(addr + offset), FLASH_SECTOR_OF(addr + offset))
+				!= CMD_SUCCESS) return -6;
+
+		if (iap_copy_ram_to_flash(data + offset, (void *)(uintptr_t)(addr + offset), size)
+				!= CMD_SUCCESS) return -7;
+	}
+
+	return flash_verify(flash_addr, data, len, 0);
+}
+
+/*
+ * Erase pages [addr, end) unless they are already blank
+ */
+static int32_t format_pages(uint32_t addr, uint32_t end) {
+	if (end <= addr || flash_is_blank((const void *)(uintptr_t)addr, end - addr)) return 0;
+	return flash_erase_pages(FLASH_PAGE_OF(addr), FLASH_PAGE_OF(end - 1));
+}
+
+/**
+ * Erase a region of whole pages as quickly as possible. The whole 1KiB
+ * sectors inside the region are erased with one ranged sector erase and
+ * only the partial sectors at either end with page range erases. Parts
+ * that are already blank are skipped.
+ *
+ * @param flash_addr Address of 64 byte aligned region in flash.
+ * @param len Length of region in bytes. Must be a multiple of 64.
+ *
+ * @return 0 for success, -1 for bad alignment, other negative value for
+ * error.
+ */
+int32_t flash_format(const void *flash_addr, uint32_t len) {
+
+	uint32_t addr = (uint32_t)(uintptr_t)flash_addr;
+	uint32_t end = addr + len;
+	uint32_t sector_start = (addr + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+	uint32_t sector_end = end / FLASH_SECTOR_SIZE;
+	int32_t status;
+
+	if ((addr % FLASH_PAGE_SIZE) != 0 || (len % FLASH_PAGE_SIZE) != 0) return -1;
+
+	// No whole sector: one page range
+	if (sector_end <= sector_start) {
+		return format_pages(addr, end);
+	}
+
+	status = format_pages(addr, sector_start * FLASH_SECTOR_SIZE);
+	if (status != 0) return status;
+
+	if ( ! flash_is_blank((const void *)(uintptr_t)(sector_start * FLASH_SECTOR_SIZE),
+			(sector_end - sector_start) * FLASH_SECTOR_SIZE)) {
+		iap_init();
+		if (iap_prepare_sector(sector_start, sector_end - 1) != CMD_SUCCESS) return -4;
+		if (iap_erase_sector(sector_start, sector_end - 1) != CMD_SUCCESS) return -5;
+		if (erase_hook) {
+			erase_hook(sector_start * FLASH_PAGES_PER_SECTOR, sector_end * FLASH_PAGES_PER_SECTOR - 1);
+		}
+	}
+
+	return format_pages(sector_end * FLASH_SECTOR_SIZE, end);
+}
+
+/**
+ * Check that flash holds the expected data, by IAP compare, in software or
+ * by CRC according to flash_verify_mode. The time taken is recorded as
+ * IAP_OP_VERIFY in iap_stats.
+ *
+ * @param flash_addr Word aligned address in flash.
+ * @param data Expected contents. Must be word aligned.
+ * @param len Number of bytes. Must be a multiple of 4.
+ * @param offset If not NULL, set to the byte offset of the first mismatch.
+ *
+ * @return 0 if equal (or verification is off), -8 on mismatch.
+ */
+int32_t flash_verify(const void *flash_addr, const uint8_t *data, uint32_t len, uint32_t *offset) {
+	const uint32_t *f = (const uint32_t *)flash_addr;
+	const uint32_t *d = (const uint32_t *)data;
+	uint32_t start, i = 0;
+	int32_t status = 0;
+
+	if (flash_verify_mode == FLASH_VERIFY_OFF) return 0;
+
+	start = iap_ticks();
+
+	if (flash_verify_mode == FLASH_VERIFY_ROM) {
+		iap_init();
+		if (iap_compare(flash_addr, data, len, &i) != CMD_SUCCESS) {
+			status = -8;
+		}
+	} else if (flash_verify_mode == FLASH_VERIFY_CRC) {
+		// Mismatch located byte by byte below
+		if (crc16(flash_addr, len) != crc16(data, len)) {
+			status = -8;
+		}
+	} else {
+		while (i < len / 4 && f[i] == d[i]) {
+			i++;
+		}
+		if (i < len / 4) {
+			status = -8;
+		}
+		i *= 4;
+	}
+
+	if (status != 0) {
+		// Narrow mismatching word down to the byte
+		while (i < len - 1 && ((const uint8_t *)flash_addr)[i] == data[i]) {
+			i++;
+		}
+		flash_verify_stats.failures++;
+		flash_verify_stats.last_offset = i;
+		if (offset) *offset = i;
+	}
+	flash_verify_stats.checks++;
+
+	iap_stats_record(IAP_OP_VERIFY, iap_ticks() - start, status);
+	return status;
+}
+
+/**
+ * Test if a 64 byte page of flash is in the erased state.
+ *
+ * @return 1 if blank, 0 otherwise.
+ */
+int flash_page_is_blank(const void *flash_page) {
+	const uint32_t *p = (const uint32_t *)flash_page;
+	int i;
+	for (i = 0; i < FLASH_PAGE_SIZE/4; i++) {
+		if (p[i] != 0xFFFFFFFF) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Test if a region of flash is in the erased state. Whole sectors in the
+ * region are checked with the IAP blank check command, the pages either
+ * side of them in software (the ROM check is sector granular, and for a
+ * few pages reading them is quicker than an IAP call).
+ *
+ * @param flash_addr Address of 64 byte aligned region in flash.
+ * @param len Length of region in bytes. Must be a multiple of 64.
+ *
+ * @return 1 if blank, 0 otherwise.
+ */
+int flash_is_blank(const void *flash_addr, uint32_t len) {
+	uint32_t addr = (uint32_t)(uintptr_t)flash_addr;
+	uint32_t end = addr + len;
+	uint32_t sector_start = (addr + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+	uint32_t sector_end = end / FLASH_SECTOR_SIZE;
+
+	if (sector_end > sector_start) {
+		iap_init();
+		if (iap_blank_check_sector(sector_start, sector_end - 1) != CMD_SUCCESS) return 0;
+	} else {
+		// No whole sectors: check every page
+		sector_start = sector_end = 0;
+	}
+
+	for (; addr < end; addr += FLASH_PAGE_SIZE) {
+		if (addr >= sector_start * FLASH_SECTOR_SIZE && addr < sector_end * FLASH_SECTOR_SIZE) {
+			continue;
+		}
+		if ( ! flash_page_is_blank((const void *)(uintptr_t)addr)) {
+			return 0;
+		}
+	}
+	return 1;
+}
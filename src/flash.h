@@ -0,0 +1,93 @@
+/*
+ * flash.h
+ *
+ * Page level helpers for writing to the LPC8xx flash from the application
+ * using the IAP driver. Flash is organised as 1KiB sectors of 16 x 64 byte
+ * pages. A page must be erased (all bits 1) before bits can be programmed
+ * to 0.
+ */
+
+#ifndef FLASH_H_
+#define FLASH_H_
+
+#include <stdint.h>
+
+#define FLASH_PAGE_SIZE (64)
+#define FLASH_SECTOR_SIZE (1024)
+#define FLASH_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE/FLASH_PAGE_SIZE)
+
+// Value of a byte of erased flash
+#define FLASH_ERASED_BYTE (0xFF)
+
+// Page / sector number of a flash address
+#define FLASH_PAGE_OF(p) ((uint32_t)(uintptr_t)(p) / FLASH_PAGE_SIZE)
+#define FLASH_SECTOR_OF(p) ((uint32_t)(uintptr_t)(p) / FLASH_SECTOR_SIZE)
+
+// Initializer for a const array of n bytes in the erased state
+#define FLASH_ERASED_INIT(n) { [0 ... (n)-1] = FLASH_ERASED_BYTE }
+
+// Attributes for a const array used as application writable flash. In the
+// host build (IAP_SIM) these are gathered into one section so that the IAP
+// simulator can find and model them (see host/iap_sim.c).
+#ifdef IAP_SIM
+#define FLASH_STORAGE __attribute__ ((aligned (FLASH_PAGE_SIZE), section ("flash_storage")))
+#else
+#define FLASH_STORAGE __attribute__ ((aligned (FLASH_PAGE_SIZE)))
+#endif
+
+// Address of a FLASH_STORAGE array hidden from the optimiser. The compiler
+// may otherwise fold reads of a const array to its initial (erased) value
+// rather than read what has since been programmed.
+#define FLASH_CONTENTS(p) ({ const void *p_ = (p); __asm__ ("" : "+r" (p_)); (const uint8_t *)p_; })
+
+// Largest number of bytes the IAP can copy to flash in one call
+#define FLASH_COPY_MAX (1024)
+
+// Ways flash_write_page() / flash_write_bulk() can bring a page to new contents
+#define FLASH_WRITE_SKIP (0)		// contents unchanged: nothing to do
+#define FLASH_WRITE_PROGRAM (1)		// only 1 to 0 bit changes: program without erase
+#define FLASH_WRITE_ERASE (2)		// erase then program
+
+// How data written by flash_write_page() / flash_write_bulk() is read back
+// and checked (flash_verify_mode). FLASH_VERIFY sets the mode at start up.
+#define FLASH_VERIFY_OFF (0)
+#define FLASH_VERIFY_ROM (1)		// IAP compare command
+#define FLASH_VERIFY_SOFTWARE (2)	// word by word compare in flash.c
+#define FLASH_VERIFY_CRC (3)		// compare CRCs (CRC engine on the LPC8xx)
+#ifndef FLASH_VERIFY
+#define FLASH_VERIFY FLASH_VERIFY_OFF
+#endif
+
+// Number of flash_write_page() / flash_write_bulk() calls that took each path
+struct flash_write_stats {
+	uint32_t skip;
+	uint32_t program;
+	uint32_t erase;
+};
+
+extern struct flash_write_stats flash_write_stats;
+
+// Called after every successful erase with the range of pages erased
+typedef void (*flash_erase_hook_fn)(uint32_t page_start, uint32_t page_end);
+
+struct flash_verify_stats {
+	uint32_t checks;
+	uint32_t failures;
+	uint32_t last_offset;	// byte offset of first mismatch of last failure
+};
+
+extern struct flash_verify_stats flash_verify_stats;
+extern uint32_t flash_verify_mode;
+
+void flash_set_erase_hook(flash_erase_hook_fn hook);
+int32_t flash_erase_pages(uint32_t page_start, uint32_t page_end);
+int32_t flash_program_page(const void *flash_page, uint8_t *data);
+int flash_write_path(const void *flash_page, const uint8_t *data);
+int32_t flash_write_page(const void *flash_page, uint8_t *data);
+int32_t flash_write_bulk(const void *flash_addr, uint8_t *data, uint32_t len);
+int32_t flash_format(const void *flash_addr, uint32_t len);
+int32_t flash_verify(const void *flash_addr, const uint8_t *data, uint32_t len, uint32_t *offset);
+int flash_page_is_blank(const void *flash_page);
+int flash_is_blank(const void *flash_addr, uint32_t len);
+
+#endif /* FLASH_H_ */
@@ -0,0 +1,145 @@
+/*
+ * flash_async.c
+ *
+ * Non-blocking 64 byte page write.
+ *
+ * flash_write_page() runs prepare, erase, prepare and copy back to back.
+ * Here the write is a small state machine: flash_async_write_page() takes
+ * a copy of the data and works out which steps are needed (none, program
+ * only, or erase then program), and each call to flash_async_poll() runs
+ * one step. The UART interrupt and the main loop run between the steps.
+ *
+ * Note that a page erase still keeps interrupts disabled for its full
+ * duration (~100ms): the ROM runs with interrupts off and flash can't be
+ * read while it is erased. What this removes is the rest of the write
+ * (the copy and both prepares) from that window, and the blocking of the
+ * main loop for the whole sequence.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "flash_async.h"
+#include "iap_driver.h"
+
+struct flash_async_stats flash_async_stats;
+
+static uint32_t state = FLASH_ASYNC_IDLE;
+static const void *page;
+static flash_async_done_fn done_fn;
+
+// Copy of the page being written. Word aligned as required by IAP copy.
+static uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+
+/*
+ * End the write and notify the caller
+ */
+static int32_t finish(int32_t status) {
+	state = FLASH_ASYNC_IDLE;
+	if (done_fn) {
+		done_fn(status);
+	}
+	return status;
+}
+
+/**
+ * Start writing a page. The data is copied so the caller's buffer can be
+ * reused immediately. Nothing is written to flash until flash_async_poll().
+ *
+ * @param flash_page Address of 64 byte aligned page in flash.
+ * @param data Pointer to 64 bytes of new page contents.
+ * @param done Function called with the result when the write completes
+ * (may be NULL).
+ *
+ * @return 0 if started, -1 if a write is already in progress.
+ */
+int32_t flash_async_write_page(const void *flash_page, const uint8_t *data,
+		flash_async_done_fn done) {
+
+	if (state != FLASH_ASYNC_IDLE) return -1;
+
+	memcpy(buf, data, FLASH_PAGE_SIZE);
+	page = flash_page;
+	done_fn = done;
+	flash_async_stats.writes++;
+
+	switch (flash_write_path(page, buf)) {
+	case FLASH_WRITE_SKIP:
+		flash_write_stats.skip++;
+		finish(0);
+		return 0;
+	case FLASH_WRITE_PROGRAM:
+		flash_write_stats.program++;
+		state = FLASH_ASYNC_PROGRAM;
+		break;
+	default:
+		flash_write_stats.erase++;
+		state = FLASH_ASYNC_ERASE;
+	}
+	return 0;
+}
+
+/**
+ * @return 1 if a write is in progress.
+ */
+int flash_async_busy(void) {
+	return state != FLASH_ASYNC_IDLE;
+}
+
+/**
+ * @return The contents a page will have once the write in progress
+ * completes, or NULL if flash_page is not being written.
+ */
+const uint8_t *flash_async_pending(const void *flash_page) {
+	return (state != FLASH_ASYNC_IDLE && flash_page == page) ? buf : 0;
+}
+
+/**
+ * Run the next step of the write in progress, if any.
+ *
+ * @return 0 if idle or the step succeeded, negative value if the write
+ * failed (the write is then abandoned).
+ */
+int32_t flash_async_poll(void) {
+	uint32_t step = state, start = iap_ticks(), t;
+	int32_t status;
+
+	switch (step) {
+	case FLASH_ASYNC_ERASE:
+		status = flash_erase_pages(FLASH_PAGE_OF(page), FLASH_PAGE_OF(page));
+		state = FLASH_ASYNC_PROGRAM;
+		break;
+	case FLASH_ASYNC_PROGRAM:
+		status = flash_program_page(page, buf);
+		if (status == 0) {
+			status = flash_verify(page, buf, FLASH_PAGE_SIZE, 0);
+		}
+		state = FLASH_ASYNC_IDLE;
+		break;
+	default:
+		return 0;
+	}
+
+	t = iap_ticks() - start;
+	if (t > flash_async_stats.step_max[step]) {
+		flash_async_stats.step_max[step] = t;
+	}
+
+	if (status != 0 || state == FLASH_ASYNC_IDLE) {
+		return finish(status);
+	}
+	return 0;
+}
+
+/**
+ * Run the write in progress to completion.
+ *
+ * @return 0 for success (or nothing to do), negative value for error.
+ */
+int32_t flash_async_wait(void) {
+	int32_t status = 0;
+	while (state != FLASH_ASYNC_IDLE && status == 0) {
+		status = flash_async_poll();
+	}
+	return status;
+}
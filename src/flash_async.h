@@ -0,0 +1,41 @@
+/*
+ * flash_async.h
+ *
+ * Non-blocking 64 byte page write. The erase and program phases of a page
+ * write are run as separate steps from the main loop (or a timer tick) so
+ * that interrupts are serviced and the console stays responsive between
+ * them.
+ */
+
+#ifndef FLASH_ASYNC_H_
+#define FLASH_ASYNC_H_
+
+#include <stdint.h>
+
+// Steps of a write
+#define FLASH_ASYNC_IDLE (0)
+#define FLASH_ASYNC_ERASE (1)	// prepare + erase page
+#define FLASH_ASYNC_PROGRAM (2)	// prepare + copy page
+#define FLASH_ASYNC_STEPS (3)
+
+// Called with the result when a write completes: from flash_async_poll(),
+// or at once by flash_async_write_page() if the page is already up to date
+typedef void (*flash_async_done_fn)(int32_t status);
+
+struct flash_async_stats {
+	uint32_t writes;
+	// Longest run of each step in IAP ticks. A step is two IAP calls, each
+	// with interrupts disabled, so this bounds the IRQ-off window.
+	uint32_t step_max[FLASH_ASYNC_STEPS];
+};
+
+extern struct flash_async_stats flash_async_stats;
+
+int32_t flash_async_write_page(const void *flash_page, const uint8_t *data,
+		flash_async_done_fn done);
+int flash_async_busy(void);
+const uint8_t *flash_async_pending(const void *flash_page);
+int32_t flash_async_poll(void);
+int32_t flash_async_wait(void);
+
+#endif /* FLASH_ASYNC_H_ */
@@ -0,0 +1,138 @@
+/*
+ * flash_counter.c
+ *
+ * Bit clearing flash counter.
+ *
+ * A counter is two pages. A page in use starts with a base value and its
+ * inverse, and its value is the base plus the number of count bits
+ * cleared. Bits are cleared in order from the first, so the value is
+ * found by skipping whole zero words and counting the zero bits of the
+ * next one.
+ *
+ * When a page is full the next increment starts the other page with the
+ * base moved on by FLASH_COUNTER_BITS and its first bit already cleared
+ * (one program call). The full page is left as it is until
+ * flash_counter_idle() erases it, so that at any time one of the pages
+ * holds the value: at start up the valid page with the higher base is the
+ * one in use.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "flash_counter.h"
+
+#define COUNT_WORDS ((FLASH_PAGE_SIZE - 8) / 4)
+
+struct counter_page {
+	uint32_t base;
+	uint32_t base_inv;
+	uint32_t bits[COUNT_WORDS];
+};
+
+#define COUNTER_PAGE(c, i) ((const struct counter_page *)((const uint8_t *)(c) + (i) * FLASH_PAGE_SIZE))
+
+static int page_is_valid(const struct counter_page *p) {
+	return p->base_inv == ~p->base;
+}
+
+/*
+ * @return Index of the page in use, or -1 if the counter has never been
+ * incremented.
+ */
+static int32_t current(const void *counter) {
+	const struct counter_page *a = COUNTER_PAGE(counter, 0);
+	const struct counter_page *b = COUNTER_PAGE(counter, 1);
+
+	if (page_is_valid(a) && page_is_valid(b)) {
+		return (b->base > a->base) ? 1 : 0;
+	}
+	if (page_is_valid(a)) return 0;
+	if (page_is_valid(b)) return 1;
+	return -1;
+}
+
+/*
+ * @return Number of count bits cleared in a page
+ */
+static uint32_t bits_cleared(const struct counter_page *p) {
+	uint32_t i = 0;
+
+	while (i < COUNT_WORDS && p->bits[i] == 0) {
+		i++;
+	}
+	if (i == COUNT_WORDS) return FLASH_COUNTER_BITS;
+	return i * 32 + __builtin_popcount(~p->bits[i]);
+}
+
+/**
+ * Read a counter.
+ *
+ * @param counter Flash defined with FLASH_COUNTER()
+ *
+ * @return Number of times the counter has been incremented.
+ */
+uint32_t flash_counter_read(const void *counter) {
+	int32_t cur = current(counter);
+	if (cur < 0) return 0;
+	return COUNTER_PAGE(counter, cur)->base + bits_cleared(COUNTER_PAGE(counter, cur));
+}
+
+/**
+ * Add one to a counter. Usually one program call; when the page in use is
+ * full the other page is started, which also needs an erase if
+ * flash_counter_idle() hasn't already done it.
+ *
+ * @param counter Flash defined with FLASH_COUNTER()
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t flash_counter_increment(const void *counter) {
+	struct counter_page buf __attribute__ ((aligned (4)));
+	const struct counter_page *p;
+	int32_t cur = current(counter);
+	uint32_t n, base;
+	int32_t status;
+
+	memset(&buf, FLASH_ERASED_BYTE, sizeof(buf));
+
+	if (cur >= 0) {
+		p = COUNTER_PAGE(counter, cur);
+		n = bits_cleared(p);
+		if (n < FLASH_COUNTER_BITS) {
+			// Clear the next bit (words left 0xFFFFFFFF are not changed)
+			buf.bits[n / 32] = p->bits[n / 32] & ~(1u << (n % 32));
+			return flash_program_page(p, (uint8_t *)&buf);
+		}
+	}
+
+	// Start the other page (or the first page of a new counter)
+	base = (cur < 0) ? 0 : COUNTER_PAGE(counter, cur)->base + FLASH_COUNTER_BITS;
+	p = COUNTER_PAGE(counter, (cur < 0) ? 0 : 1 - cur);
+	if ( ! flash_page_is_blank(p)) {
+		status = flash_erase_pages(FLASH_PAGE_OF(p), FLASH_PAGE_OF(p));
+		if (status != 0) return status;
+	}
+	buf.base = base;
+	buf.base_inv = ~base;
+	buf.bits[0] = ~1u;
+	return flash_program_page(p, (uint8_t *)&buf);
+}
+
+/**
+ * Call when idle. Erases the page not in use (if it isn't blank) so that
+ * the next page change only needs a program.
+ *
+ * @param counter Flash defined with FLASH_COUNTER()
+ *
+ * @return 0 for success or nothing to do, negative value for error.
+ */
+int32_t flash_counter_idle(const void *counter) {
+	int32_t cur = current(counter);
+	const struct counter_page *p;
+
+	if (cur < 0) return 0;
+	p = COUNTER_PAGE(counter, 1 - cur);
+	if (flash_page_is_blank(p)) return 0;
+	return flash_erase_pages(FLASH_PAGE_OF(p), FLASH_PAGE_OF(p));
+}
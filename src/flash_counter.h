@@ -0,0 +1,32 @@
+/*
+ * flash_counter.h
+ *
+ * Monotonic counter kept in flash that counts by clearing one bit per
+ * increment, so that a page is erased once every FLASH_COUNTER_BITS
+ * increments instead of on every increment. Suitable for boot counts and
+ * event counters.
+ */
+
+#ifndef FLASH_COUNTER_H_
+#define FLASH_COUNTER_H_
+
+#include <stdint.h>
+
+#include "flash.h"
+
+// Flash used by a counter: two pages, each a base value and its inverse
+// followed by the count bits
+#define FLASH_COUNTER_SIZE (2 * FLASH_PAGE_SIZE)
+
+// Increments per page (per erase)
+#define FLASH_COUNTER_BITS ((FLASH_PAGE_SIZE - 8) * 8)
+
+// Define the flash for a counter, eg FLASH_COUNTER(boot_counter);
+#define FLASH_COUNTER(name) \
+	const uint8_t name[FLASH_COUNTER_SIZE] FLASH_STORAGE = FLASH_ERASED_INIT(FLASH_COUNTER_SIZE)
+
+uint32_t flash_counter_read(const void *counter);
+int32_t flash_counter_increment(const void *counter);
+int32_t flash_counter_idle(const void *counter);
+
+#endif /* FLASH_COUNTER_H_ */
@@ -0,0 +1,20 @@
+/*
+ * hal.h
+ *
+ * The little bit of hardware main() needs directly: pin setup, a free
+ * running timer and reset. Implemented for the LPC8xx in hal_lpc8xx.c and
+ * for the Linux host build in host/hal_host.c (which also provides the
+ * uart.h and systick.h functions).
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+void hal_init(void);
+void hal_timer_init(void);
+uint32_t hal_timer_now(void);
+void hal_reset(void);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,66 @@
+/*
+ * hal_lpc8xx.c
+ *
+ * LPC8xx implementation of hal.h.
+ */
+
+#include "LPC8xx.h"
+#include "hal.h"
+
+/**
+ * Configure SwitchMatrix to enable UART on pins used for in-circuit serial
+ * programming. Code generated by NXP's SwitchMatrix PinMux configuration tool.
+ *
+ * UART RXD on SOIC package pin 19 (default for ISP mode)
+ * UART TXD on SOIC package pin 5 (default for ISP mode)
+ * RESET, SWD (SWDIO, SWCLK) enabled.
+ */
+static void SwitchMatrix_Init()
+{
+    /* Enable SWM clock */
+    LPC_SYSCON->SYSAHBCLKCTRL |= (1<<7);
+
+    /* Pin Assign 8 bit Configuration */
+    /* U0_TXD */
+    /* U0_RXD */
+    LPC_SWM->PINASSIGN0 = 0xffff0004UL;
+
+    /* Pin Assign 1 bit Configuration */
+    /* SWCLK */
+    /* SWDIO */
+    /* RESET */
+    LPC_SWM->PINENABLE0 = 0xffffffb3UL;
+
+}
+
+/**
+ * Set up pins. Called first thing in main().
+ */
+void hal_init(void) {
+	SwitchMatrix_Init();
+}
+
+/**
+ * Start the SCT as a free running 32 bit timer for timing flash write
+ * operations. Ref UM10601 chapter 10.
+ */
+void hal_timer_init(void) {
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1 << 8);
+	LPC_SYSCON->PRESETCTRL |= ( 1<< 8);
+	LPC_SCT->CONFIG = 1;		 // config as bus clocked (12MHz) 32 bit timer
+	LPC_SCT->CTRL_U &= ~(1<<2);  // unhalt to start clock
+}
+
+/**
+ * @return Timer count (bus clock ticks)
+ */
+uint32_t hal_timer_now(void) {
+	return LPC_SCT->COUNT_U;
+}
+
+/**
+ * Reboot the device. Does not return.
+ */
+void hal_reset(void) {
+	NVIC_SystemReset();
+}
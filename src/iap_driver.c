@@ -19,6 +19,7 @@
 
 #include <LPC8xx.h>
 #include "iap_driver.h"
+#include "iap_stats.h"
 
 /*
  * The IAP funtion address in LPC11xx ROM
@@ -59,10 +60,33 @@ static struct __result_table result_table;
 typedef unsigned int (*IAP)(struct __cmd_table*, struct __result_table*);
 static const IAP iap_call = (IAP) IAP_ADDRESS;
 
+/*
+ * Call IAP with interrupts disabled, recording latency and result
+ */
+static void iap_call_timed(uint32_t op) {
+	uint32_t start = iap_ticks();
+
+	__disable_irq();
+	iap_call(&cmd_table, &result_table);
+	__enable_irq();
+
+	iap_stats_record(op, iap_ticks() - start, (int)result_table.ret_code);
+}
+
 /*---------------------------------------------------------------------------
  * Public functions
  */
 
+/**
+ * Read timer used for IAP statistics. The SCT must be clocked and running
+ * (see ENABLE_TIMER in main) or this returns a constant.
+ *
+ * @return SCT count (bus clock ticks)
+ */
+uint32_t iap_ticks(void) {
+	return LPC_SCT->COUNT_U;
+}
+
 /**
  * Init IAP driver
  * @return    0 for success
@@ -90,9 +114,7 @@ int iap_erase_sector(unsigned int sector_start, unsigned int sector_end) {
 	cmd_table.param[1] = sector_end;
 	cmd_table.param[2] = SystemCoreClock / 1000;
 
-	__disable_irq();
-	iap_call(&cmd_table, &result_table);
-	__enable_irq();
+	iap_call_timed(IAP_OP_ERASE_SECTOR);
 
 	return (int)result_table.ret_code;
 }
@@ -112,9 +134,7 @@ int iap_erase_page(unsigned int page_start, unsigned int page_end) {
 	cmd_table.param[1] = page_end;
 	cmd_table.param[2] = SystemCoreClock / 1000;
 
-	__disable_irq();
-	iap_call(&cmd_table, &result_table);
-	__enable_irq();
+	iap_call_timed(IAP_OP_ERASE_PAGE);
 
 	return (int)result_table.ret_code;
 }
@@ -132,9 +152,25 @@ int iap_prepare_sector(unsigned int sector_start, unsigned int sector_end) {
 	cmd_table.param[0] = sector_start;
 	cmd_table.param[1] = sector_end;
 
-	__disable_irq();
-	iap_call(&cmd_table, &result_table);
-	__enable_irq();
+	iap_call_timed(IAP_OP_PREPARE);
+
+	return (int)result_table.ret_code;
+}
+
+/**
+ * Blank check flash sector(s)
+ *
+ * @param sector_start  The start of the sector to be checked
+ * @param sector_end    The end of the sector to be checked
+ *
+ * @return CMD_SUCCESS, BUSY, SECTOR_NOT_BLANK, or INVALID_SECTOR
+ */
+int iap_blank_check_sector(unsigned int sector_start, unsigned int sector_end) {
+	cmd_table.cmd_code = BLANK_CHECK_SECTOR;
+	cmd_table.param[0] = sector_start;
+	cmd_table.param[1] = sector_end;
+
+	iap_call_timed(IAP_OP_BLANK_CHECK);
 
 	return (int)result_table.ret_code;
 }
@@ -159,9 +195,33 @@ int iap_copy_ram_to_flash(void* ram_address, void* flash_address,
 	cmd_table.param[2] = count;
 	cmd_table.param[3] = SystemCoreClock / 1000;
 
-	__disable_irq();
-	iap_call(&cmd_table, &result_table);
-	__enable_irq();
+	iap_call_timed(IAP_OP_COPY);
+
+	return (int)result_table.ret_code;
+}
+
+/**
+ * Compare memory (flash or RAM)
+ *
+ * @param dst     Destination address, word aligned
+ * @param src     Source address, word aligned
+ * @param count   Number of bytes to compare, multiple of 4
+ * @param offset  Set to the byte offset of the first mismatching word
+ *                when COMPARE_ERROR is returned
+ *
+ * @return CMD_SUCCESS, COMPARE_ERROR, COUNT_ERROR, SRC_ADDR_ERROR,
+ *         DST_ADDR_ERROR, SRC_ADDR_NOT_MAPPED or DST_ADDR_NOT_MAPPED
+ */
+int iap_compare(const void *dst, const void *src, unsigned int count,
+		uint32_t *offset) {
+	cmd_table.cmd_code = COMPARE;
+	cmd_table.param[0] = (uint32_t) dst;
+	cmd_table.param[1] = (uint32_t) src;
+	cmd_table.param[2] = count;
+
+	iap_call_timed(IAP_OP_COMPARE);
+
+	*offset = result_table.result[0];
 
 	return (int)result_table.ret_code;
 }
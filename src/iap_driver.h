@@ -38,6 +38,12 @@ typedef enum {
     BUSY,
 } __e_iap_status;
 
+/**
+* Read timer used for IAP statistics
+* @return    SCT count
+*/
+uint32_t iap_ticks(void);
+
 /**
 * Init IAP driver
 * @return    0 for success
@@ -76,6 +82,16 @@ int iap_erase_page(unsigned int page_start, unsigned int page_end);
  */
 int iap_prepare_sector(unsigned int sector_start, unsigned int sector_end);
 
+/**
+ * Blank check flash sector(s)
+ *
+ * @param sector_start  The start of the sector to be checked
+ * @param sector_end    The end of the sector to be checked
+ *
+ * @return CMD_SUCCESS, BUSY, SECTOR_NOT_BLANK, or INVALID_SECTOR
+ */
+int iap_blank_check_sector(unsigned int sector_start, unsigned int sector_end);
+
 /**
  * Copy RAM contents into flash
  *
@@ -91,6 +107,21 @@ int iap_prepare_sector(unsigned int sector_start, unsigned int sector_end);
 int iap_copy_ram_to_flash(void* ram_address, void* flash_address,
         unsigned int count);
 
+/**
+ * Compare memory (flash or RAM)
+ *
+ * @param dst     Destination address, word aligned
+ * @param src     Source address, word aligned
+ * @param count   Number of bytes to compare, multiple of 4
+ * @param offset  Set to the byte offset of the first mismatching word
+ *                when COMPARE_ERROR is returned
+ *
+ * @return CMD_SUCCESS, COMPARE_ERROR, COUNT_ERROR, SRC_ADDR_ERROR,
+ *         DST_ADDR_ERROR, SRC_ADDR_NOT_MAPPED or DST_ADDR_NOT_MAPPED
+ */
+int iap_compare(const void *dst, const void *src, unsigned int count,
+		uint32_t *offset);
+
 /**
  * Read part ID
  *
@@ -0,0 +1,61 @@
+/*
+ * iap_stats.c
+ *
+ * Per-operation latency statistics for IAP flash calls.
+ */
+
+#include <string.h>
+
+#include "iap_stats.h"
+#include "iap_driver.h"
+
+#ifdef ENABLE_IAP_STATS
+
+struct iap_op_stats iap_stats[IAP_OP_COUNT];
+
+char * const iap_op_names[IAP_OP_COUNT] = {
+	"prepare",
+	"erase page",
+	"erase sector",
+	"copy",
+	"blank check",
+	"commit",
+	"compare",
+	"verify",
+};
+
+/**
+ * Record the outcome of one IAP call.
+ *
+ * @param op Operation (IAP_OP_xxx)
+ * @param ticks Latency in SCT ticks
+ * @param status IAP status code returned
+ */
+void iap_stats_record(uint32_t op, uint32_t ticks, int status) {
+	struct iap_op_stats *s = &iap_stats[op];
+	uint32_t bin = 0, t = ticks >> IAP_STATS_SHIFT;
+
+	s->calls++;
+	if (status != CMD_SUCCESS) s->failures++;
+	if (status == BUSY) s->busy++;
+
+	if (s->calls == 1 || ticks < s->min) s->min = ticks;
+	if (ticks > s->max) s->max = ticks;
+	s->total += ticks;
+
+	// log2 histogram
+	while (t != 0 && bin < IAP_STATS_BINS - 1) {
+		bin++;
+		t >>= 1;
+	}
+	if (s->hist[bin] != 0xFFFF) s->hist[bin]++;
+}
+
+/**
+ * Clear all statistics.
+ */
+void iap_stats_reset(void) {
+	memset(iap_stats, 0, sizeof(iap_stats));
+}
+
+#endif
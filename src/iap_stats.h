@@ -0,0 +1,65 @@
+/*
+ * iap_stats.h
+ *
+ * Per-operation latency statistics for IAP flash calls. Latency is
+ * measured in SCT ticks (12MHz bus clock by default).
+ */
+
+#ifndef IAP_STATS_H_
+#define IAP_STATS_H_
+
+#include <stdint.h>
+
+// The statistics are kept only if ENABLE_IAP_STATS is defined (see main).
+// They take about 500 bytes of SRAM, too much for the LPC810 (1KiB), so
+// they are off by default and iap_stats_record() does nothing.
+
+// Histogram bin 0 counts latencies below 2^IAP_STATS_SHIFT ticks, bin n
+// (n > 0) counts latencies from 2^(n+IAP_STATS_SHIFT-1) up to twice that.
+// The last bin also counts anything longer.
+#define IAP_STATS_BINS (16)
+#define IAP_STATS_SHIFT (6)
+
+// Operations with statistics
+#define IAP_OP_PREPARE (0)
+#define IAP_OP_ERASE_PAGE (1)
+#define IAP_OP_ERASE_SECTOR (2)
+#define IAP_OP_COPY (3)
+#define IAP_OP_BLANK_CHECK (4)
+#define IAP_OP_COMMIT (5)		// whole storage layer commit, not a single IAP call
+#define IAP_OP_COMPARE (6)
+#define IAP_OP_VERIFY (7)		// flash_verify(), by ROM or software compare
+#define IAP_OP_COUNT (8)
+
+struct iap_op_stats {
+	uint32_t calls;
+	uint32_t failures;	// status other than CMD_SUCCESS (including BUSY)
+	uint32_t busy;		// status BUSY
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint16_t hist[IAP_STATS_BINS];
+};
+
+#ifdef ENABLE_IAP_STATS
+
+extern struct iap_op_stats iap_stats[IAP_OP_COUNT];
+extern char * const iap_op_names[IAP_OP_COUNT];
+
+void iap_stats_record(uint32_t op, uint32_t ticks, int status);
+void iap_stats_reset(void);
+
+#else
+
+static inline void iap_stats_record(uint32_t op, uint32_t ticks, int status) {
+	(void)op;
+	(void)ticks;
+	(void)status;
+}
+
+static inline void iap_stats_reset(void) {
+}
+
+#endif
+
+#endif /* IAP_STATS_H_ */
@@ -0,0 +1,192 @@
+/*
+ * journal.c
+ *
+ * Append only event journal.
+ *
+ * The region is a ring of JOURNAL_SLOTS 8 byte record slots per page,
+ * filled in order. Every page but the one at the head is either full or
+ * erased, and the first records of consecutive pages have sequence numbers
+ * JOURNAL_SLOTS apart. So at mount the head page is found with a binary
+ * search for the last page, counting from page 0, whose first record is
+ * in sequence with that of page 0, and the head slot by a binary search
+ * for the first blank slot of that page. Mounting reads O(log n) slots
+ * instead of the whole region.
+ *
+ * When the head reaches a page that still holds old records that page is
+ * erased (by journal_idle() ahead of time if possible).
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "systick.h"
+#include "journal.h"
+
+#if JOURNAL_PAGES < 2
+#error "JOURNAL_PAGES must be at least 2"
+#endif
+
+#define TOTAL_SLOTS (JOURNAL_PAGES * JOURNAL_SLOTS)
+
+// Flash region used for the journal. Must be 64 byte aligned and start erased.
+static const uint8_t journal_region[JOURNAL_PAGES * FLASH_PAGE_SIZE]
+	FLASH_STORAGE
+	= FLASH_ERASED_INIT(JOURNAL_PAGES * FLASH_PAGE_SIZE);
+
+#define SLOT(i) ((const struct journal_record *)FLASH_CONTENTS(journal_region) + (i))
+#define PAGE_ADDR(p) (FLASH_CONTENTS(journal_region) + (p) * FLASH_PAGE_SIZE)
+
+// Next slot to write, number of records held and next sequence number
+static uint32_t head;
+static uint32_t count;
+static uint16_t next_seq;
+
+static int slot_is_blank(uint32_t i) {
+	const uint32_t *w = (const uint32_t *)SLOT(i);
+	return w[0] == 0xFFFFFFFF && w[1] == 0xFFFFFFFF;
+}
+
+/*
+ * @return 1 if page p has been written since page 0 was last started
+ */
+static int page_follows_first(uint32_t p) {
+	return ! slot_is_blank(p * JOURNAL_SLOTS)
+			&& (uint16_t)(SLOT(p * JOURNAL_SLOTS)->seq - SLOT(0)->seq) == p * JOURNAL_SLOTS;
+}
+
+/*
+ * Erase page p if it isn't already blank
+ */
+static int32_t page_recycle(uint32_t p) {
+	int32_t status;
+
+	if (flash_is_blank(PAGE_ADDR(p), FLASH_PAGE_SIZE)) return 0;
+	status = flash_erase_pages(FLASH_PAGE_OF(PAGE_ADDR(p)), FLASH_PAGE_OF(PAGE_ADDR(p)));
+	if (status == 0 && count > TOTAL_SLOTS - JOURNAL_SLOTS) {
+		count = TOTAL_SLOTS - JOURNAL_SLOTS;
+	}
+	return status;
+}
+
+/**
+ * Find the head of the journal. Must be called before any other journal
+ * function.
+ *
+ * @return 0 for success.
+ */
+int32_t journal_mount(void) {
+	uint32_t lo, hi, mid, p, n;
+
+	head = 0;
+	count = 0;
+	next_seq = 0;
+
+	if ( ! slot_is_blank(0)) {
+		// Last page in sequence with page 0
+		lo = 0;
+		hi = JOURNAL_PAGES;
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (page_follows_first(mid)) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		p = lo;
+	} else if ( ! slot_is_blank((JOURNAL_PAGES - 1) * JOURNAL_SLOTS)) {
+		// Page 0 erased ready for the head to wrap onto it
+		p = JOURNAL_PAGES - 1;
+	} else {
+		return 0;
+	}
+
+	// First blank slot in the head page (slot 0 is written)
+	lo = 0;
+	hi = JOURNAL_SLOTS;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (slot_is_blank(p * JOURNAL_SLOTS + mid)) {
+			hi = mid;
+		} else {
+			lo = mid;
+		}
+	}
+	n = hi;
+
+	head = (p * JOURNAL_SLOTS + n) % TOTAL_SLOTS;
+	next_seq = SLOT(p * JOURNAL_SLOTS + n - 1)->seq + 1;
+
+	// Pages other than the head page are full or erased
+	count = n;
+	for (mid = 0; mid < JOURNAL_PAGES; mid++) {
+		if (mid != p && ! slot_is_blank(mid * JOURNAL_SLOTS)) {
+			count += JOURNAL_SLOTS;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Append an event to the journal. Costs one program call, plus an erase
+ * if the head has reached a page that journal_idle() hasn't yet erased.
+ *
+ * @param type Event type (JOURNAL_BOOT etc)
+ * @param arg Event specific argument
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t journal_append(uint8_t type, uint8_t arg) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	struct journal_record *r = (struct journal_record *)buf + head % JOURNAL_SLOTS;
+	int32_t status;
+
+	if (head % JOURNAL_SLOTS == 0) {
+		status = page_recycle(head / JOURNAL_SLOTS);
+		if (status != 0) return status;
+	}
+
+	memset(buf, FLASH_ERASED_BYTE, sizeof(buf));
+	r->ms = systick_now();
+	r->type = type;
+	r->arg = arg;
+	r->seq = next_seq;
+
+	status = flash_program_page(PAGE_ADDR(head / JOURNAL_SLOTS), buf);
+	if (status != 0) return status;
+
+	head = (head + 1) % TOTAL_SLOTS;
+	next_seq++;
+	count++;
+
+	return 0;
+}
+
+/**
+ * @return Number of records in the journal.
+ */
+uint32_t journal_count(void) {
+	return count;
+}
+
+/**
+ * @param n Record to get, 0 for the newest
+ *
+ * @return Pointer to record in flash, or 0 if there are not that many.
+ */
+const struct journal_record *journal_get(uint32_t n) {
+	if (n >= count) return 0;
+	return SLOT((head + TOTAL_SLOTS - 1 - n) % TOTAL_SLOTS);
+}
+
+/**
+ * Call when idle. Once the head page is full, erases the oldest page so
+ * that the next append only needs a program.
+ *
+ * @return 0 for success or nothing to do, negative value for error.
+ */
+int32_t journal_idle(void) {
+	if (head % JOURNAL_SLOTS != 0) return 0;
+	return page_recycle(head / JOURNAL_SLOTS);
+}
@@ -0,0 +1,40 @@
+/*
+ * journal.h
+ *
+ * Append only journal of timestamped events (boots, resets, faults) in a
+ * reserved flash region. Fixed size records are programmed into erased
+ * slots; when the region is full the oldest page is erased and reused.
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+
+// Number of 64 byte flash pages in the journal region (at least 2)
+#ifndef JOURNAL_PAGES
+#define JOURNAL_PAGES (4)
+#endif
+
+// Event types
+#define JOURNAL_BOOT (1)		// arg: 0
+#define JOURNAL_RESET (2)		// arg: command character that caused it
+#define JOURNAL_WRITE_FAIL (3)	// arg: negated write status
+#define JOURNAL_FORMAT (4)		// arg: 0
+
+struct journal_record {
+	uint32_t ms;		// systick_now() when appended (time since boot)
+	uint8_t type;
+	uint8_t arg;
+	uint16_t seq;		// incremented for every record
+};
+
+#define JOURNAL_SLOTS (64 / sizeof(struct journal_record))
+
+int32_t journal_mount(void);
+int32_t journal_append(uint8_t type, uint8_t arg);
+uint32_t journal_count(void);
+const struct journal_record *journal_get(uint32_t n);
+int32_t journal_idle(void);
+
+#endif /* JOURNAL_H_ */
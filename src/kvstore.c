@@ -0,0 +1,266 @@
+/*
+ * kvstore.c
+ *
+ * Small flash-backed key/value store.
+ *
+ * The region is a circular sequence of 64 byte pages managed the same way
+ * as eeprom_log.c: each page starts with a 16 bit sequence number (and its
+ * complement), the page after the head is kept erased and when the head
+ * fills the oldest page is recycled after carrying its live records
+ * forward into the new head page.
+ *
+ * Records are {key, len, crc16 lo, crc16 hi} followed by len value bytes,
+ * padded to a multiple of 4 bytes. The CRC covers key, len and value so a
+ * record torn by power failure is ignored. A record with len 0 deletes the
+ * key.
+ *
+ * The SRAM index holds, for each key, the offset in the region of its
+ * newest record (or KV_NONE).
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "crc.h"
+#include "kvstore.h"
+
+#if KVSTORE_PAGES < 3
+#error "KVSTORE_PAGES must be at least 3"
+#endif
+
+#define KV_NONE (0xFFFF)
+#define KV_BLANK_KEY (0xFF)
+#define KV_PAGE_HEADER (4)
+#define KV_RECORD_HEADER (4)
+#define KV_RECORD_SIZE(len) (KV_RECORD_HEADER + (((len) + 3) & ~3))
+
+// Flash region used for the store. Must be 64 byte aligned and start erased.
+static const uint8_t kvstore_region[KVSTORE_PAGES * FLASH_PAGE_SIZE]
+	FLASH_STORAGE
+	= FLASH_ERASED_INIT(KVSTORE_PAGES * FLASH_PAGE_SIZE);
+
+#define KV_PAGE(i) (FLASH_CONTENTS(kvstore_region) + (i) * FLASH_PAGE_SIZE)
+
+// Offset in region of newest record of each key
+static uint16_t kv_index[KVSTORE_MAX_KEYS];
+
+// Head page index (-1 if region is empty), offset of next free byte in
+// head page and head page sequence number
+static int32_t head = -1;
+static uint32_t head_off;
+static uint16_t head_seq;
+
+static int page_is_valid(const uint8_t *p) {
+	uint16_t seq = p[0] | (p[1] << 8);
+	uint16_t inv = p[2] | (p[3] << 8);
+	return inv == (uint16_t)~seq;
+}
+
+static uint16_t page_seq(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint16_t record_crc(uint8_t key, uint8_t len, const uint8_t *value) {
+	uint8_t h[2] = {key, len};
+	return crc16_update(crc16(h, 2), value, len);
+}
+
+/**
+ * Check the record at offset off within a page.
+ *
+ * @return Size of record if valid, 0 if blank, -1 if torn / corrupt.
+ */
+static int32_t record_check(const uint8_t *page, uint32_t off) {
+	const uint8_t *r = page + off;
+	if (r[0] == KV_BLANK_KEY) return 0;
+	if (r[0] >= KVSTORE_MAX_KEYS || r[1] > KVSTORE_MAX_VALUE
+			|| off + KV_RECORD_SIZE(r[1]) > FLASH_PAGE_SIZE) return -1;
+	if ((r[2] | (r[3] << 8)) != record_crc(r[0], r[1], r + KV_RECORD_HEADER)) return -1;
+	return KV_RECORD_SIZE(r[1]);
+}
+
+static void record_set(uint8_t *r, uint8_t key, const uint8_t *value, uint8_t len) {
+	uint16_t crc = record_crc(key, len, value);
+	r[0] = key;
+	r[1] = len;
+	r[2] = crc & 0xFF;
+	r[3] = crc >> 8;
+	memcpy(r + KV_RECORD_HEADER, value, len);
+}
+
+/**
+ * Move the head to the next (erased) page, carrying forward the live
+ * records of the oldest page and then erasing it.
+ */
+static int32_t rotate(void) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	uint32_t next = (head < 0) ? 0 : (head + 1) % KVSTORE_PAGES;
+	uint32_t oldest = (next + 1) % KVSTORE_PAGES;
+	const uint8_t *op = KV_PAGE(oldest);
+	uint32_t off, n = KV_PAGE_HEADER;
+	uint16_t seq = head_seq + 1;
+	int32_t size, status;
+
+	memset(buf, FLASH_ERASED_BYTE, sizeof(buf));
+	buf[0] = seq & 0xFF;
+	buf[1] = seq >> 8;
+	buf[2] = ~seq & 0xFF;
+	buf[3] = ~seq >> 8;
+
+	if (head >= 0 && page_is_valid(op)) {
+		for (off = KV_PAGE_HEADER; off < FLASH_PAGE_SIZE; off += size) {
+			size = record_check(op, off);
+			if (size <= 0) break;
+			if (kv_index[op[off]] == oldest * FLASH_PAGE_SIZE + off) {
+				memcpy(buf + n, op + off, size);
+				kv_index[op[off]] = next * FLASH_PAGE_SIZE + n;
+				n += size;
+			}
+		}
+	}
+
+	if ( ! flash_page_is_blank(KV_PAGE(next))) {
+		status = flash_erase_pages(FLASH_PAGE_OF(KV_PAGE(next)), FLASH_PAGE_OF(KV_PAGE(next)));
+		if (status != 0) return status;
+	}
+
+	status = flash_program_page(KV_PAGE(next), buf);
+	if (status != 0) return status;
+
+	if ( ! flash_page_is_blank(op)) {
+		status = flash_erase_pages(FLASH_PAGE_OF(op), FLASH_PAGE_OF(op));
+		if (status != 0) return status;
+	}
+
+	head = next;
+	head_off = n;
+	head_seq = seq;
+
+	return 0;
+}
+
+/**
+ * Scan the store region once and build the SRAM index. Must be called
+ * before any other kvstore function.
+ *
+ * @return 0 for success.
+ */
+int32_t kvstore_mount(void) {
+	uint32_t i, off;
+	int32_t size;
+
+	memset(kv_index, 0xFF, sizeof(kv_index));
+	head = -1;
+	head_off = 0;
+	head_seq = 0;
+
+	// Head is the valid page with the highest sequence number
+	for (i = 0; i < KVSTORE_PAGES; i++) {
+		const uint8_t *p = KV_PAGE(i);
+		if ( ! page_is_valid(p)) continue;
+		if (head < 0 || (int16_t)(page_seq(p) - head_seq) > 0) {
+			head = i;
+			head_seq = page_seq(p);
+		}
+	}
+
+	if (head < 0) {
+		return 0;
+	}
+
+	// Replay from the oldest page around to the head
+	for (i = 1; i <= KVSTORE_PAGES; i++) {
+		uint32_t pi = (head + i) % KVSTORE_PAGES;
+		const uint8_t *p = KV_PAGE(pi);
+		if ( ! page_is_valid(p)) continue;
+		for (off = KV_PAGE_HEADER; off < FLASH_PAGE_SIZE; off += size) {
+			size = record_check(p, off);
+			if (size <= 0) break;
+			kv_index[p[off]] = (p[off + 1] == 0) ? KV_NONE : pi * FLASH_PAGE_SIZE + off;
+		}
+		if (pi == (uint32_t)head) {
+			// A torn record has unknown length: start a new page on next write
+			head_off = (size < 0) ? FLASH_PAGE_SIZE : off;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Erase the whole store, deleting every key.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t kvstore_format(void) {
+	int32_t status = flash_format(kvstore_region, sizeof(kvstore_region));
+	kvstore_mount();
+	return status;
+}
+
+/**
+ * Look up a key.
+ *
+ * @param key Key (0 to KVSTORE_MAX_KEYS-1)
+ * @param len Set to the length of the value
+ *
+ * @return Pointer to the value in flash, or 0 if the key is not set.
+ */
+const uint8_t *kvstore_get(uint32_t key, uint32_t *len) {
+	if (key >= KVSTORE_MAX_KEYS || kv_index[key] == KV_NONE) {
+		return 0;
+	}
+	const uint8_t *r = FLASH_CONTENTS(kvstore_region) + kv_index[key];
+	*len = r[1];
+	return r + KV_RECORD_HEADER;
+}
+
+/**
+ * Set the value of a key by appending a record. Setting a key to its
+ * current value does not touch flash.
+ *
+ * @param key Key (0 to KVSTORE_MAX_KEYS-1)
+ * @param value Pointer to value
+ * @param len Length of value (0 to KVSTORE_MAX_VALUE). 0 deletes the key.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t kvstore_set(uint32_t key, const uint8_t *value, uint32_t len) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	const uint8_t *cur;
+	uint32_t cur_len, i;
+	int32_t status;
+
+	if (key >= KVSTORE_MAX_KEYS || len > KVSTORE_MAX_VALUE) return -1;
+
+	cur = kvstore_get(key, &cur_len);
+	if (cur == 0 && len == 0) return 0;
+	if (cur != 0 && cur_len == len && memcmp(cur, value, len) == 0) return 0;
+
+	// Each rotation frees the oldest page. If the store is full of live
+	// records no amount of rotation will make room.
+	for (i = 0; head < 0 || head_off + KV_RECORD_SIZE(len) > FLASH_PAGE_SIZE; i++) {
+		if (i == KVSTORE_PAGES) return -2;
+		status = rotate();
+		if (status != 0) return status;
+	}
+
+	memset(buf, FLASH_ERASED_BYTE, sizeof(buf));
+	record_set(buf + head_off, key, value, len);
+	status = flash_program_page(KV_PAGE(head), buf);
+	if (status != 0) return status;
+
+	kv_index[key] = (len == 0) ? KV_NONE : head * FLASH_PAGE_SIZE + head_off;
+	head_off += KV_RECORD_SIZE(len);
+
+	return 0;
+}
+
+/**
+ * Remove a key.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t kvstore_delete(uint32_t key) {
+	return kvstore_set(key, 0, 0);
+}
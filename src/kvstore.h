@@ -0,0 +1,35 @@
+/*
+ * kvstore.h
+ *
+ * Small flash-backed key/value store with variable length values. Records
+ * are appended to a log-structured multi-page region; overwriting a key
+ * appends a new record. A RAM index of KVSTORE_MAX_KEYS x 2 bytes built
+ * at mount gives O(1) lookup without walking flash.
+ */
+
+#ifndef KVSTORE_H_
+#define KVSTORE_H_
+
+#include <stdint.h>
+
+// Keys are small integers 0 to KVSTORE_MAX_KEYS-1. Each key costs 2 bytes
+// of SRAM for the index.
+#ifndef KVSTORE_MAX_KEYS
+#define KVSTORE_MAX_KEYS (32)
+#endif
+
+// Number of 64 byte flash pages in the store region (at least 3)
+#ifndef KVSTORE_PAGES
+#define KVSTORE_PAGES (8)
+#endif
+
+// Largest value that fits in a page with page and record headers
+#define KVSTORE_MAX_VALUE (56)
+
+int32_t kvstore_mount(void);
+int32_t kvstore_format(void);
+const uint8_t *kvstore_get(uint32_t key, uint32_t *len);
+int32_t kvstore_set(uint32_t key, const uint8_t *value, uint32_t len);
+int32_t kvstore_delete(uint32_t key);
+
+#endif /* KVSTORE_H_ */
@@ -36,4 +36,26 @@ uint32_t parse_hex (uint8_t *buf) {
 	return res;
 }
 
-
+/**
+ * Parse a string of hex digit pairs (eg "0A1BFF") into bytes.
+ *
+ * @param buf Zero terminated string
+ * @param out Buffer for parsed bytes
+ * @param max Size of out
+ *
+ * @return Number of bytes parsed or -1 if string is malformed or too long.
+ */
+int parse_hex_bytes (uint8_t *buf, uint8_t *out, int max) {
+	int n = 0, hi, lo;
+
+	while (*buf != 0) {
+		hi = is_hex_digit(buf[0]);
+		lo = is_hex_digit(buf[1]);
+		if (hi < 0 || lo < 0 || n == max) {
+			return -1;
+		}
+		out[n++] = (hi << 4) | lo;
+		buf += 2;
+	}
+	return n;
+}
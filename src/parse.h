@@ -8,5 +8,6 @@
 #define PARSE_H_
 
 uint32_t parse_hex (uint8_t *buf);
+int parse_hex_bytes (uint8_t *buf, uint8_t *out, int max);
 
 #endif /* PARSE_H_ */
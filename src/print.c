@@ -33,7 +33,7 @@ void print_hex16(uint16_t v) {
 }
 void print_hex32(uint32_t v) {
 	int i, h;
-	for (i = 24; i >= 0; i -= 4) {
+	for (i = 28; i >= 0; i -= 4) {
 		h = (v >> i) & 0x0f;
 		if (h < 10) {
 			uart_send_byte('0' + h);
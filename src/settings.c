@@ -0,0 +1,229 @@
+/*
+ * settings.c
+ *
+ * Settings schema support: defaults, version check and access to fields
+ * by name (for the console). Typed accessors are inline in settings.h.
+ *
+ * In SETTINGS_OVERLAY mode a field's key/value record is written only
+ * while it differs from the default and deleted when it returns to it, so
+ * a node with factory settings stores nothing. The first record written
+ * is preceded by one holding SETTINGS_VERSION, so that records of an
+ * older layout can be recognised and dropped.
+ */
+
+#include <string.h>
+
+#include "settings.h"
+#ifdef SETTINGS_OVERLAY
+#include "kvstore.h"
+#endif
+
+#define SETTINGS_FIELD_ENTRY(type, name, def) \
+	{ #name, SETTINGS_OFFSET(name), sizeof(type) },
+
+const struct settings_field settings_fields[SETTINGS_FIELD_COUNT] = {
+	SETTINGS_FIELDS(SETTINGS_FIELD_ENTRY)
+};
+
+settings_source_fn settings_source;
+
+#ifdef SETTINGS_OVERLAY
+
+_Static_assert(SETTINGS_KEY_BASE + SETTINGS_FIELD_COUNT <= KVSTORE_MAX_KEYS,
+		"settings keys don't fit in the key/value store");
+
+#define SETTINGS_DEFAULT_INIT(type, name, def) .name = def,
+
+// Defaults, in code flash
+static const struct settings defaults = {
+	SETTINGS_FIELDS(SETTINGS_DEFAULT_INIT)
+};
+
+#define DEFAULT_BYTES(id) ((const uint8_t *)&defaults + settings_fields[id].offset)
+
+/**
+ * Copy the current value of a field: its stored record if it has one,
+ * otherwise its default.
+ *
+ * @param id Field (SETTINGS_FIELD_<name>)
+ * @param value Where to copy the value (size of the field)
+ */
+void settings_read(uint32_t id, void *value) {
+	const uint8_t *v;
+	uint32_t len;
+
+	v = kvstore_get(SETTINGS_KEY_BASE + id, &len);
+	if (v == 0 || len != settings_fields[id].size) {
+		v = DEFAULT_BYTES(id);
+	}
+	memcpy(value, v, settings_fields[id].size);
+}
+
+/**
+ * Set a field. Only a value that differs from the default is stored.
+ *
+ * @param id Field (SETTINGS_FIELD_<name>)
+ * @param value Pointer to new value (size of the field)
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t settings_write(uint32_t id, const void *value) {
+	uint32_t len;
+	int32_t status;
+
+	if (memcmp(value, DEFAULT_BYTES(id), settings_fields[id].size) == 0) {
+		// Back to default: drop the record (nothing written if none)
+		return kvstore_delete(SETTINGS_KEY_BASE + id);
+	}
+
+	if (kvstore_get(SETTINGS_KEY_BASE + SETTINGS_FIELD_version, &len) == 0) {
+		status = kvstore_set(SETTINGS_KEY_BASE + SETTINGS_FIELD_version,
+				&defaults.version, sizeof(defaults.version));
+		if (status != 0) return status;
+	}
+	return kvstore_set(SETTINGS_KEY_BASE + id, value, settings_fields[id].size);
+}
+
+/**
+ * Check the stored records are of this schema version and drop them if
+ * not. The kvstore must be mounted first.
+ *
+ * @param source Not used
+ * @param stage Not used
+ *
+ * @return 1 if the defaults were applied, 0 otherwise.
+ */
+int settings_init(settings_source_fn source, settings_stage_fn stage) {
+	(void)source;
+	(void)stage;
+
+	if (settings_get_version() == SETTINGS_VERSION) return 0;
+	settings_reset();
+	return 1;
+}
+
+/**
+ * Return every field to its default by deleting its record. The version
+ * record goes last so that an interrupted reset is redone at start up.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t settings_reset(void) {
+	int32_t status = 0;
+	uint32_t id;
+
+	for (id = SETTINGS_FIELD_COUNT; id-- > 0 && status == 0; ) {
+		status = kvstore_delete(SETTINGS_KEY_BASE + id);
+	}
+	return status;
+}
+
+#else
+
+static settings_stage_fn stage_fn;
+
+/**
+ * Set the functions used to read and write the bank, and reset the
+ * settings to their defaults if the bank doesn't hold this schema version.
+ *
+ * @param source Function returning the current contents of the bank
+ * @param stage Function staging one byte write to the bank
+ *
+ * @return 1 if the defaults were applied, 0 otherwise.
+ */
+int settings_init(settings_source_fn source, settings_stage_fn stage) {
+	settings_source = source;
+	stage_fn = stage;
+
+	if (settings_get_version() == SETTINGS_VERSION) return 0;
+	settings_reset();
+	return 1;
+}
+
+/**
+ * Stage every field at its default value (including version).
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t settings_reset(void) {
+	int32_t status = 0;
+
+#define SETTINGS_DEFAULT(type, name, def) \
+	if (status == 0) status = settings_set_##name(def);
+
+	SETTINGS_FIELDS(SETTINGS_DEFAULT)
+
+	return status;
+}
+
+/**
+ * Stage the bytes of a field.
+ *
+ * @param offset Offset of field in bank
+ * @param value Pointer to new value
+ * @param len Size of field
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t settings_stage(uint32_t offset, const void *value, uint32_t len) {
+	const uint8_t *v = (const uint8_t *)value;
+	int32_t status = 0;
+	uint32_t i;
+
+	for (i = 0; i < len && status == 0; i++) {
+		status = stage_fn(offset + i, v[i]);
+	}
+	return status;
+}
+
+#endif
+
+/**
+ * @return Field called name, or 0 if there isn't one.
+ */
+const struct settings_field *settings_find(const char *name) {
+	uint32_t i;
+	for (i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+		if (strcmp(settings_fields[i].name, name) == 0) {
+			return &settings_fields[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * @return Value of a field of up to 4 bytes (not sign extended).
+ */
+uint32_t settings_get_field(const struct settings_field *f) {
+	uint8_t p[4];
+	uint32_t i, v = 0;
+
+#ifdef SETTINGS_OVERLAY
+	settings_read(f - settings_fields, p);
+#else
+	memcpy(p, settings_source() + f->offset, f->size);
+#endif
+	for (i = 0; i < f->size; i++) {
+		v |= (uint32_t)p[i] << (i * 8);
+	}
+	return v;
+}
+
+/**
+ * Set a field of up to 4 bytes.
+ *
+ * @return 0 for success, negative value for error.
+ */
+int32_t settings_set_field(const struct settings_field *f, uint32_t value) {
+	uint8_t v[4];
+	uint32_t i;
+
+	for (i = 0; i < f->size; i++) {
+		v[i] = value >> (i * 8);
+	}
+#ifdef SETTINGS_OVERLAY
+	return settings_write(f - settings_fields, v);
+#else
+	return settings_stage(f->offset, v, f->size);
+#endif
+}
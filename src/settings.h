@@ -0,0 +1,103 @@
+/*
+ * settings.h
+ *
+ * Typed access to settings held in the 'EEPROM' bank. The fields are
+ * declared once in settings_schema.h; their offsets and the total size are
+ * fixed at compile time from a packed struct, and for each field
+ * settings_get_<name>() and settings_set_<name>() are generated.
+ *
+ * A get reads only the bytes of the field from the bank; a set stages only
+ * those bytes (eg in the write cache or log store), it doesn't rewrite the
+ * whole bank.
+ *
+ * With SETTINGS_OVERLAY (settings_schema.h) there is no bank: a field that
+ * differs from its default is a key/value store record and a get of any
+ * other field returns the default.
+ */
+
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "settings_schema.h"
+
+// Size of the bank the settings are kept in
+#define SETTINGS_BANK_SIZE (64)
+
+#define SETTINGS_STRUCT_FIELD(type, name, def) type name;
+
+struct settings {
+	SETTINGS_FIELDS(SETTINGS_STRUCT_FIELD)
+} __attribute__ ((packed));
+
+#define SETTINGS_SIZE (sizeof(struct settings))
+#define SETTINGS_OFFSET(name) (offsetof(struct settings, name))
+
+_Static_assert(SETTINGS_SIZE <= SETTINGS_BANK_SIZE, "settings don't fit in the EEPROM bank");
+_Static_assert(SETTINGS_OFFSET(version) == 0, "version must be the first setting");
+
+// Function returning the current contents of the bank (eg eeprom_read())
+typedef const uint8_t *(*settings_source_fn)(void);
+
+// Function staging one byte write to the bank
+typedef int32_t (*settings_stage_fn)(uint32_t addr, uint8_t val);
+
+// Name, offset and size of each field, for access by name
+struct settings_field {
+	const char *name;
+	uint8_t offset;
+	uint8_t size;
+};
+
+#define SETTINGS_FIELD_ID(type, name, def) SETTINGS_FIELD_##name,
+enum {
+	SETTINGS_FIELDS(SETTINGS_FIELD_ID)
+	SETTINGS_FIELD_COUNT
+};
+
+extern const struct settings_field settings_fields[SETTINGS_FIELD_COUNT];
+extern settings_source_fn settings_source;
+
+int settings_init(settings_source_fn source, settings_stage_fn stage);
+int32_t settings_reset(void);
+const struct settings_field *settings_find(const char *name);
+uint32_t settings_get_field(const struct settings_field *f);
+int32_t settings_set_field(const struct settings_field *f, uint32_t value);
+
+#ifdef SETTINGS_OVERLAY
+
+void settings_read(uint32_t id, void *value);
+int32_t settings_write(uint32_t id, const void *value);
+
+#define SETTINGS_ACCESSORS(type, name, def) \
+static inline type settings_get_##name(void) { \
+	type v; \
+	settings_read(SETTINGS_FIELD_##name, &v); \
+	return v; \
+} \
+static inline int32_t settings_set_##name(type v) { \
+	return settings_write(SETTINGS_FIELD_##name, &v); \
+}
+
+#else
+
+int32_t settings_stage(uint32_t offset, const void *value, uint32_t len);
+
+#define SETTINGS_ACCESSORS(type, name, def) \
+static inline type settings_get_##name(void) { \
+	type v; \
+	memcpy(&v, settings_source() + SETTINGS_OFFSET(name), sizeof(v)); \
+	return v; \
+} \
+static inline int32_t settings_set_##name(type v) { \
+	return settings_stage(SETTINGS_OFFSET(name), &v, sizeof(v)); \
+}
+
+#endif
+
+SETTINGS_FIELDS(SETTINGS_ACCESSORS)
+
+#endif /* SETTINGS_H_ */
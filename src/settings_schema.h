@@ -0,0 +1,34 @@
+/*
+ * settings_schema.h
+ *
+ * Layout of the settings held in the 'EEPROM' bank (see settings.h). Each
+ * field is X(type, name, default). Fields are packed in the order listed.
+ *
+ * version must stay the first field. Increment SETTINGS_VERSION when the
+ * layout changes: settings stored with any other version are reset to the
+ * defaults at start up.
+ */
+
+#ifndef SETTINGS_SCHEMA_H_
+#define SETTINGS_SCHEMA_H_
+
+#define SETTINGS_VERSION (1)
+
+// Keep only the fields that differ from their defaults, in the key/value
+// store (keys SETTINGS_KEY_BASE onwards), instead of the whole layout in
+// the bank. Defaults stay in code flash.
+//#define SETTINGS_OVERLAY
+#ifndef SETTINGS_KEY_BASE
+#define SETTINGS_KEY_BASE (16)
+#endif
+
+#define SETTINGS_FIELDS(X) \
+	X(uint8_t,  version,     SETTINGS_VERSION) \
+	X(uint8_t,  node_id,     1) \
+	X(uint32_t, baud_rate,   9600) \
+	X(uint16_t, sample_ms,   1000) \
+	X(int16_t,  cal_offset,  0) \
+	X(uint16_t, cal_gain,    0x100) \
+	X(uint8_t,  flags,       0)
+
+#endif /* SETTINGS_SCHEMA_H_ */
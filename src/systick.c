@@ -0,0 +1,30 @@
+/*
+ * systick.c
+ *
+ * Coarse millisecond time base using the Cortex-M0+ SysTick timer. The
+ * periodic interrupt also wakes the CPU from WFI so that idle work can be
+ * done while waiting for input.
+ */
+
+#include "LPC8xx.h"
+#include "systick.h"
+
+static volatile uint32_t systick_ms = 0;
+
+/**
+ * Start SysTick interrupt every SYSTICK_PERIOD_MS milliseconds.
+ */
+void systick_init(void) {
+	SysTick_Config(SystemCoreClock / 1000 * SYSTICK_PERIOD_MS);
+}
+
+/**
+ * @return Milliseconds since systick_init() (resolution SYSTICK_PERIOD_MS).
+ */
+uint32_t systick_now(void) {
+	return systick_ms;
+}
+
+void SysTick_Handler(void) {
+	systick_ms += SYSTICK_PERIOD_MS;
+}
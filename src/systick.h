@@ -0,0 +1,18 @@
+/*
+ * systick.h
+ *
+ * Coarse millisecond time base using the Cortex-M0+ SysTick timer.
+ */
+
+#ifndef SYSTICK_H_
+#define SYSTICK_H_
+
+#include <stdint.h>
+
+// SysTick interrupt period. A long period keeps WFI sleep efficient.
+#define SYSTICK_PERIOD_MS (10)
+
+void systick_init(void);
+uint32_t systick_now(void);
+
+#endif /* SYSTICK_H_ */
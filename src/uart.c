@@ -12,9 +12,32 @@
 #include "LPC8xx.h"
 #include "uart.h"
 
-volatile uint8_t uart_rxbuf[UART_BUF_SIZE];
-volatile uint32_t uart_rxbuf_index=0;
-volatile uint32_t uart_rxbuf_flags=0;
+volatile struct uart_rx_stats uart_rx_stats;
+
+// Receive line slots. The IRQ handler fills the slot at head; complete
+// lines are handed to the main loop in order from tail.
+static char uart_rxline[UART_RX_LINES][UART_RX_LINE_SIZE];
+static volatile uint8_t uart_rxline_len[UART_RX_LINES];
+static volatile uint32_t uart_rxline_head=0;
+static volatile uint32_t uart_rxline_tail=0;
+static volatile uint32_t uart_rxline_count=0;	// complete lines pending
+static uint32_t uart_rxline_index=0;			// next byte in head slot
+static int uart_rxline_discard=0;				// dropping rest of current line
+static int uart_rxline_truncated=0;				// current line has been truncated
+static int uart_rxline_held=0;					// tail slot is in use by caller
+
+// Transmit ring buffer. Bytes are added at head and removed at tail by the
+// TXRDY interrupt. Empty when head == tail.
+static volatile uint8_t uart_txbuf[UART_TXBUF_SIZE];
+static volatile uint32_t uart_txbuf_head=0;
+static volatile uint32_t uart_txbuf_tail=0;
+
+// Called between interrupts while waiting for a line of input
+static void (*uart_idle_hook)(void) = 0;
+
+// Called from the IRQ handler for each byte received. Returns non-zero if
+// it has consumed the byte, in which case it is not added to the line.
+static int (*uart_rx_hook)(uint8_t c) = 0;
 
 /*****************************************************************************
 ** Function name:		UARTInit
@@ -68,7 +91,8 @@ void uart_init(uint32_t baudrate)
 
 	// Enable UART interrupt
 	NVIC_EnableIRQ(UART0_IRQn);
-	UARTx->INTENSET = UART_STAT_RXRDY | UART_STAT_TXRDY | UART_STAT_DELTA_RXBRK;	/* Enable UART interrupt */
+	UARTx->INTENSET = UART_STAT_RXRDY | UART_STAT_TXRDY | UART_STAT_DELTA_RXBRK
+			| UART_STAT_OVRN_ERR | UART_STAT_FRM_ERR;	/* Enable UART interrupt */
 
 	UARTx->CFG |= UART_CFG_UART_EN;
 
@@ -77,44 +101,113 @@ void uart_init(uint32_t baudrate)
 
 
 /**
- * Transmit one byte on UART. If FIFO is full it will block
- * until byte can be transmitted.
+ * Add byte to transmit ring buffer. Must not be interrupted by another
+ * caller of uart_tx_put().
+ *
+ * @return 1 if added, 0 if buffer full
+ */
+static int uart_tx_put (uint8_t v) {
+	uint32_t next = (uart_txbuf_head + 1) & (UART_TXBUF_SIZE - 1);
+	if (next == uart_txbuf_tail) {
+		return 0;
+	}
+	uart_txbuf[uart_txbuf_head] = v;
+	uart_txbuf_head = next;
+	return 1;
+}
+
+/**
+ * Queue one byte for transmission on UART. Returns immediately unless the
+ * transmit buffer is full, in which case it will block until there is
+ * space. Bytes are sent by the TXRDY interrupt.
  */
 void uart_send_byte (uint8_t v) {
-	  // wait until data can be written to TXDATA
-	  while ( ! (LPC_USART0->STAT & (1<<2)) );
-	  LPC_USART0->TXDATA = v;
+	int queued;
+
+	do {
+		// UART IRQ handler also queues bytes (echo)
+		__disable_irq();
+		queued = uart_tx_put(v);
+		__enable_irq();
+	} while ( ! queued);
+
+	// TXRDY interrupt drains buffer
+	LPC_USART0->INTENSET = UART_STAT_TXRDY;
 }
 
 /**
- * Read a CR terminated line. Cannot exceed UART_BUF_SIZE.
+ * Set function to be called repeatedly while uart_read_line() is waiting
+ * for input. It is called each time the CPU wakes from sleep, so a periodic
+ * interrupt (eg SysTick) is needed for it to run when the line is quiet.
  */
-int uart_read_line (char *buf) {
+void uart_set_idle_hook (void (*hook)(void)) {
+	uart_idle_hook = hook;
+}
 
-	// Wait until EOL flag set by IRQ handler.
-	while ( ! (uart_rxbuf_flags & UART_BUF_FLAG_EOL)) {
-		__WFI(); // Can reduce power by sleeping between IRQs
+/**
+ * Set function to be called from the IRQ handler for each byte received,
+ * before line handling. If it returns non-zero the byte is consumed (not
+ * echoed or added to the line). Runs in interrupt context.
+ */
+void uart_set_rx_hook (int (*hook)(uint8_t c)) {
+	uart_rx_hook = hook;
+}
+
+/**
+ * Wait for a CR terminated line. No copy is made: the returned pointer is
+ * to the zero terminated line in the receive slot, which the caller may
+ * modify. It remains valid until the next call to uart_read_line().
+ *
+ * @param len Set to the length of the line (excluding terminator)
+ *
+ * @return Pointer to line
+ */
+char *uart_read_line (uint32_t *len) {
+
+	// Hand back slot returned by previous call
+	if (uart_rxline_held) {
+		uart_rxline_tail = (uart_rxline_tail + 1) % UART_RX_LINES;
+		__disable_irq();
+		uart_rxline_count--;
+		__enable_irq();
+		uart_rxline_held = 0;
 	}
 
-	// Copy from uart.c internal buffer to supplied buffer.
-	int i=0;
-	do {
-		buf[i] = uart_rxbuf[i];
-	} while (uart_rxbuf[i++]!=0);
+	// Wait until a complete line is available
+	while (uart_rxline_count == 0) {
+		if (uart_idle_hook) {
+			uart_idle_hook();
+		}
+		__WFI(); // Can reduce power by sleeping between IRQs
+	}
 
-	// Reset buffer and flags
-	uart_rxbuf_index=0;
-	uart_rxbuf_flags=0;
+	uart_rxline_held = 1;
+	*len = uart_rxline_len[uart_rxline_tail];
+	return uart_rxline[uart_rxline_tail];
 }
 
 /**
- * Wait until all bytes in FIFO have been transmitted. Typical
+ * Wait until all bytes in buffer and FIFO have been transmitted. Typical
  * use to ensure that a "reboot" or "sleep" message has been
  * fully transmitted before rebooting/sleeping etc.
  */
 void uart_drain () {
+	// Wait for TXRDY interrupt to empty buffer
+	while (uart_txbuf_head != uart_txbuf_tail);
+
 	// Wait for TXIDLE flag to be asserted
-	while ( ! (LPC_USART0->STAT & (1<<3)) );
+	while ( ! (LPC_USART0->STAT & UART_STAT_TXIDLE) );
+}
+
+/**
+ * Send zero-terminated string from within the UART IRQ handler. Bytes that
+ * don't fit in the transmit buffer are dropped rather than blocking.
+ */
+static void uart_send_string_isr (char *buf) {
+	while (*buf != 0) {
+		uart_tx_put(*buf++);
+	}
+	LPC_USART0->INTENSET = UART_STAT_TXRDY;
 }
 
 /**
@@ -127,11 +220,60 @@ void uart_send_string_z (char *buf) {
 	}
 }
 
+/**
+ * Add a received byte to the current line, handing the line to
+ * uart_read_line() on CR. Called from the IRQ handler.
+ */
+static void uart_rx_line_byte (uint8_t c) {
+
+	// If all slots hold pending lines, drop this line
+	if (uart_rxline_count == UART_RX_LINES) {
+		uart_rxline_discard = 1;
+	}
+
+	// If CR flag EOL
+	if (c=='\r') {
+		if (uart_rxline_discard) {
+			uart_rx_stats.dropped++;
+		} else {
+			uart_rxline[uart_rxline_head][uart_rxline_index]=0; // zero-terminate line
+			uart_rxline_len[uart_rxline_head] = uart_rxline_index;
+			uart_rxline_head = (uart_rxline_head + 1) % UART_RX_LINES;
+			uart_rxline_count++;
+		}
+		uart_rxline_index = 0;
+		uart_rxline_discard = 0;
+		uart_rxline_truncated = 0;
+		uart_send_string_isr("\r\n");
+	} else if (c>31){
+		if ( ! uart_rxline_discard) {
+			if (uart_rxline_index < UART_RX_LINE_SIZE - 1) {
+				uart_rxline[uart_rxline_head][uart_rxline_index++] = c;
+			} else if ( ! uart_rxline_truncated) {
+				uart_rx_stats.truncated++;
+				uart_rxline_truncated = 1;
+			}
+		}
+		if (uart_tx_put(c)) {
+			LPC_USART0->INTENSET = UART_STAT_TXRDY;
+		}
+	}
+}
+
 void UART0_IRQHandler(void)
 {
 
 	uint32_t uart_status = LPC_USART0->STAT;
 
+	// Count and clear (write 1 to clear) receive errors
+	if (uart_status & UART_STAT_OVRN_ERR) {
+		uart_rx_stats.overrun++;
+	}
+	if (uart_status & UART_STAT_FRM_ERR) {
+		uart_rx_stats.framing++;
+	}
+	LPC_USART0->STAT = uart_status & (UART_STAT_OVRN_ERR | UART_STAT_FRM_ERR);
+
 	// UM10601 §15.6.3, Table 162, p181. USART Status Register.
 	// Bit 0 RXRDY: 1 = data is available to be read from RXDATA
 	// Bit 2 TXRDY: 1 = data may be written to TXDATA
@@ -139,24 +281,22 @@ void UART0_IRQHandler(void)
 
 		uint8_t c = LPC_USART0->RXDATA;
 
-		// If CR flag EOL
-		if (c=='\r') {
-			uart_rxbuf_flags |= UART_BUF_FLAG_EOL;
-			uart_rxbuf[uart_rxbuf_index]=0; // zero-terminate buffer
-			uart_send_string_z("\r\n");
-		} else if (c>31){
-			uart_rxbuf[uart_rxbuf_index] = c;
-			uart_rxbuf_index++;
-			//if (uart_rxbuf_index == UART_BUF_SIZE) {
-				//MyUARTBufReset();
-			//}
-			uart_send_byte(c);
+		if (uart_rx_hook && uart_rx_hook(c)) {
+			// Byte consumed by hook
+		} else {
+			uart_rx_line_byte(c);
 		}
+	}
 
+	if (uart_status & UART_STAT_TXRDY ) {
 
-	} else if (uart_status & UART_STAT_TXRDY ){
-
-		LPC_USART0->INTENCLR = 0x04;
+		if (uart_txbuf_tail != uart_txbuf_head) {
+			LPC_USART0->TXDATA = uart_txbuf[uart_txbuf_tail];
+			uart_txbuf_tail = (uart_txbuf_tail + 1) & (UART_TXBUF_SIZE - 1);
+		} else {
+			// Nothing more to send
+			LPC_USART0->INTENCLR = UART_STAT_TXRDY;
+		}
 	}
 
 }
@@ -8,6 +8,8 @@
 #ifndef MYUART_H_
 #define MYUART_H_
 
+#include <stdint.h>
+
 #ifdef __USE_CMSIS
 #include "LPC8xx.h"
 #endif
@@ -15,7 +17,13 @@
 // Need this for bit constants
 //#include "lpc8xx_uart.h"
 
-#define UART_BUF_SIZE (80)
+// Receive line slots. Several complete lines can be pending while the main
+// loop is busy. Lines longer than UART_RX_LINE_SIZE-1 are truncated.
+#define UART_RX_LINES (4)
+#define UART_RX_LINE_SIZE (32)
+
+// Transmit ring buffer size. Must be a power of 2.
+#define UART_TXBUF_SIZE (64)
 
 /* UART configuration register bit definitions */
 #define UART_CFG_UART_EN       (0x01<<0)
@@ -41,14 +49,23 @@
 #define UART_STAT_PAR_ERR       (0x01<<14)
 #define UART_STAT_RXNOISE       (0x01<<15)
 
-// End of line flag
-#define UART_BUF_FLAG_EOL (0x01<<0)
+// Receive error and overflow counts
+struct uart_rx_stats {
+	uint32_t overrun;	// hardware overrun: byte lost before it could be read
+	uint32_t framing;	// framing error
+	uint32_t dropped;	// lines dropped because all line slots were full
+	uint32_t truncated;	// lines truncated to UART_RX_LINE_SIZE-1
+};
+
+extern volatile struct uart_rx_stats uart_rx_stats;
 
 void uart_init(uint32_t baudrate);
 void uart_send_byte(uint8_t v);
 void uart_send_string_z(char *);
 
-int uart_read_line(char *buf);
+char *uart_read_line(uint32_t *len);
 void uart_drain (void);
+void uart_set_idle_hook (void (*hook)(void));
+void uart_set_rx_hook (int (*hook)(uint8_t c));
 
 #endif /* MYUART_H_ */
@@ -0,0 +1,321 @@
+/*
+ * wear.c
+ *
+ * Persistent per-page flash erase counters.
+ *
+ * Counting an erase must not itself cost an erase, so counts are kept as a
+ * tally: each erase of a tracked page programs one two byte {id, ~id}
+ * record into the next free slot of the tally pages, and the count of a
+ * page is its base count plus its tally records. The base counts live in
+ * a header page with the page number of each tracked page. A page seen
+ * for the first time is added by programming its entry into the next
+ * blank slot of the header, again without an erase.
+ *
+ * When the tally pages are full the counters are compacted: the totals are
+ * written as the base counts of a fresh copy in the other bank (one ranged
+ * erase of WEAR_BANK_PAGES pages, so each wear page is erased once for
+ * every 2 x 96 tracked erases with the default 4 page bank). The header
+ * carries a sequence number; at mount the valid copy with the highest
+ * sequence number is used.
+ *
+ * The recent erase rate of each page is counted in SRAM over the current
+ * and previous WEAR_RATE_WINDOW_MS.
+ */
+
+#include <string.h>
+
+#include "flash.h"
+#include "systick.h"
+#include "wear.h"
+
+#if WEAR_BANK_PAGES < 2
+#error "WEAR_BANK_PAGES must be at least 2"
+#endif
+
+#define WEAR_NONE (0xFFFF)
+#define WEAR_BASE_MAX (0xFFFE)
+#define WEAR_TALLIES ((WEAR_BANK_PAGES - 1) * FLASH_PAGE_SIZE / sizeof(struct wear_tally))
+
+struct wear_entry {
+	uint16_t page;		// encoded page number (WEAR_NONE if slot unused)
+	uint16_t base;		// erase count when the copy was written
+};
+
+struct wear_header {
+	uint16_t seq;
+	uint16_t seq_inv;
+	struct wear_entry entry[WEAR_MAX_PAGES];
+};
+
+struct wear_tally {
+	uint8_t id;
+	uint8_t id_inv;
+};
+
+// Two copies (banks) of the counters. Must be 64 byte aligned and start erased.
+static const uint8_t wear_region[2 * WEAR_BANK_PAGES * FLASH_PAGE_SIZE]
+	FLASH_STORAGE
+	= FLASH_ERASED_INIT(2 * WEAR_BANK_PAGES * FLASH_PAGE_SIZE);
+
+#define WEAR_BANK(b) (FLASH_CONTENTS(wear_region) + (b) * WEAR_BANK_PAGES * FLASH_PAGE_SIZE)
+#define WEAR_HEADER(b) ((const struct wear_header *)WEAR_BANK(b))
+#define WEAR_TALLY(b) ((const struct wear_tally *)(WEAR_BANK(b) + FLASH_PAGE_SIZE))
+
+// Page numbers are stored relative to the wear region, which keeps them in
+// 16 bits wherever flash is (eg in the host build)
+#define WEAR_PAGE_ENCODE(p) ((uint16_t)((p) - FLASH_PAGE_OF(wear_region) + 0x8000))
+#define WEAR_PAGE_DECODE(v) ((uint32_t)(v) + FLASH_PAGE_OF(wear_region) - 0x8000)
+
+struct wear_stats wear_stats;
+
+// Current bank (-1 if none written yet) and its sequence number
+static int32_t bank = -1;
+static uint16_t bank_seq;
+
+// Tracked pages and their counts
+static uint32_t n_pages;
+static uint32_t page_no[WEAR_MAX_PAGES];
+static uint32_t count[WEAR_MAX_PAGES];
+
+// Tally slots used in current bank
+static uint32_t n_tallies;
+
+// Erases per page in the current and previous rate window
+static uint16_t recent[2][WEAR_MAX_PAGES];
+static uint32_t window_start;
+static int have_previous;
+
+// Set while counters are being written, so that their own erases are not
+// counted
+static int busy;
+
+static int header_is_valid(const struct wear_header *h) {
+	return h->seq_inv == (uint16_t)~h->seq;
+}
+
+/*
+ * Write a fresh copy of the counters to the other bank
+ */
+static int32_t compact(void) {
+	struct wear_header buf __attribute__ ((aligned (4)));
+	uint32_t target = (bank < 0) ? 0 : 1 - bank;
+	uint32_t i;
+	int32_t status;
+
+	if ( ! flash_is_blank(WEAR_BANK(target), WEAR_BANK_PAGES * FLASH_PAGE_SIZE)) {
+		status = flash_erase_pages(FLASH_PAGE_OF(WEAR_BANK(target)),
+				FLASH_PAGE_OF(WEAR_BANK(target)) + WEAR_BANK_PAGES - 1);
+		if (status != 0) return status;
+	}
+
+	memset(&buf, FLASH_ERASED_BYTE, sizeof(buf));
+	buf.seq = bank_seq + 1;
+	buf.seq_inv = ~buf.seq;
+	for (i = 0; i < n_pages; i++) {
+		buf.entry[i].page = WEAR_PAGE_ENCODE(page_no[i]);
+		buf.entry[i].base = (count[i] > WEAR_BASE_MAX) ? WEAR_BASE_MAX : count[i];
+	}
+
+	status = flash_program_page(WEAR_BANK(target), (uint8_t *)&buf);
+	if (status != 0) return status;
+
+	bank = target;
+	bank_seq = buf.seq;
+	n_tallies = 0;
+	wear_stats.compactions++;
+
+	return 0;
+}
+
+/*
+ * Find the id of a tracked page, adding it if there is room.
+ *
+ * @return id, or -1 if the page isn't tracked and the table is full
+ */
+static int32_t page_id(uint32_t page) {
+	struct wear_header buf __attribute__ ((aligned (4)));
+	uint32_t i;
+
+	for (i = 0; i < n_pages; i++) {
+		if (page_no[i] == page) return i;
+	}
+	if (n_pages == WEAR_MAX_PAGES) return -1;
+
+	page_no[n_pages] = page;
+	count[n_pages] = 0;
+	n_pages++;
+
+	// Program the new entry into the blank slot of the current header
+	if (bank >= 0) {
+		memset(&buf, FLASH_ERASED_BYTE, sizeof(buf));
+		buf.entry[n_pages - 1].page = WEAR_PAGE_ENCODE(page);
+		buf.entry[n_pages - 1].base = 0;
+		flash_program_page(WEAR_BANK(bank), (uint8_t *)&buf);
+	}
+
+	return n_pages - 1;
+}
+
+/*
+ * Append a tally record for id
+ */
+static int32_t tally(uint32_t id) {
+	uint8_t buf[FLASH_PAGE_SIZE] __attribute__ ((aligned (4)));
+	uint32_t slot_page = n_tallies / (FLASH_PAGE_SIZE / sizeof(struct wear_tally));
+	uint32_t off = (n_tallies * sizeof(struct wear_tally)) % FLASH_PAGE_SIZE;
+
+	memset(buf, FLASH_ERASED_BYTE, sizeof(buf));
+	buf[off] = id;
+	buf[off + 1] = ~id;
+	n_tallies++;
+
+	return flash_program_page((const uint8_t *)WEAR_TALLY(bank) + slot_page * FLASH_PAGE_SIZE, buf);
+}
+
+/*
+ * Start a new rate window if the current one has ended
+ */
+static void roll_window(void) {
+	uint32_t elapsed = systick_now() - window_start;
+
+	if (elapsed < WEAR_RATE_WINDOW_MS) return;
+
+	if (elapsed < 2 * WEAR_RATE_WINDOW_MS) {
+		memcpy(recent[1], recent[0], sizeof(recent[0]));
+		window_start += WEAR_RATE_WINDOW_MS;
+	} else {
+		// Nothing in the previous window either
+		memset(recent[1], 0, sizeof(recent[1]));
+		window_start = systick_now();
+	}
+	memset(recent[0], 0, sizeof(recent[0]));
+	have_previous = 1;
+}
+
+/**
+ * Load the counters. Must be called before any other wear function (and
+ * before the erase hook is set).
+ *
+ * @return 0 for success.
+ */
+int32_t wear_mount(void) {
+	uint32_t b, i;
+
+	bank = -1;
+	bank_seq = 0;
+	n_pages = 0;
+	n_tallies = 0;
+	memset(recent, 0, sizeof(recent));
+	window_start = systick_now();
+	have_previous = 0;
+
+	for (b = 0; b < 2; b++) {
+		const struct wear_header *h = WEAR_HEADER(b);
+		if ( ! header_is_valid(h)) continue;
+		if (bank < 0 || (int16_t)(h->seq - bank_seq) > 0) {
+			bank = b;
+			bank_seq = h->seq;
+		}
+	}
+	if (bank < 0) return 0;
+
+	const struct wear_header *h = WEAR_HEADER(bank);
+	while (n_pages < WEAR_MAX_PAGES && h->entry[n_pages].page != WEAR_NONE) {
+		page_no[n_pages] = WEAR_PAGE_DECODE(h->entry[n_pages].page);
+		// Base of an entry whose program was torn reads as erased
+		count[n_pages] = (h->entry[n_pages].base == 0xFFFF) ? 0 : h->entry[n_pages].base;
+		n_pages++;
+	}
+
+	// Add tallies up to the first blank slot. Corrupt records use a slot
+	// but don't count.
+	const struct wear_tally *t = WEAR_TALLY(bank);
+	while (n_tallies < WEAR_TALLIES
+			&& ! (t[n_tallies].id == 0xFF && t[n_tallies].id_inv == 0xFF)) {
+		i = t[n_tallies].id;
+		if (i < n_pages && t[n_tallies].id_inv == (uint8_t)~i) {
+			count[i]++;
+		}
+		n_tallies++;
+	}
+
+	return 0;
+}
+
+/**
+ * Count an erase of a range of pages. Intended to be set as the flash
+ * erase hook: flash_set_erase_hook(wear_erased).
+ */
+void wear_erased(uint32_t page_start, uint32_t page_end) {
+	uint32_t page;
+	int32_t id;
+
+	if (busy) return;
+	busy = 1;
+
+	roll_window();
+
+	for (page = page_start; page <= page_end; page++) {
+		id = page_id(page);
+		if (id < 0) {
+			wear_stats.untracked++;
+			continue;
+		}
+
+		count[id]++;
+		if (recent[0][id] != 0xFFFF) recent[0][id]++;
+
+		// A full (or missing) copy is replaced by one holding this erase
+		if (bank < 0 || n_tallies == WEAR_TALLIES) {
+			compact();
+		} else {
+			tally(id);
+		}
+	}
+
+	busy = 0;
+}
+
+/**
+ * @return Erase count of the page holding flash_addr (0 if not tracked).
+ */
+uint32_t wear_count(const void *flash_addr) {
+	uint32_t i;
+	for (i = 0; i < n_pages; i++) {
+		if (page_no[i] == FLASH_PAGE_OF(flash_addr)) return count[i];
+	}
+	return 0;
+}
+
+/**
+ * Summarise wear: most worn page, total erases and, from the recent erase
+ * rate of each page, the time until the first page reaches WEAR_ENDURANCE.
+ */
+void wear_summarize(struct wear_summary *s) {
+	uint32_t i, n, hours, span_s;
+
+	roll_window();
+	span_s = (systick_now() - window_start + (have_previous ? WEAR_RATE_WINDOW_MS : 0)) / 1000;
+	if (span_s == 0) span_s = 1;
+
+	memset(s, 0, sizeof(*s));
+	s->pages = n_pages;
+	s->hours_left = WEAR_NO_LIMIT;
+
+	for (i = 0; i < n_pages; i++) {
+		s->total += count[i];
+		if (count[i] >= s->worst_count) {
+			s->worst_count = count[i];
+			s->worst_page = page_no[i] * FLASH_PAGE_SIZE;
+		}
+
+		n = recent[0][i] + recent[1][i];
+		if (n == 0) continue;
+		hours = (count[i] >= WEAR_ENDURANCE) ? 0
+				: (WEAR_ENDURANCE - count[i]) * span_s / (n * 3600);
+		if (hours < s->hours_left) {
+			s->hours_left = hours;
+			s->rate = n * 3600 / span_s;
+		}
+	}
+}
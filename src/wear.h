@@ -0,0 +1,59 @@
+/*
+ * wear.h
+ *
+ * Persistent per-page flash erase counters with recent erase rate and
+ * projected time to the erase endurance limit. Pages are tracked
+ * automatically the first time they are erased (see flash_set_erase_hook()).
+ */
+
+#ifndef WEAR_H_
+#define WEAR_H_
+
+#include <stdint.h>
+
+// Most pages that can be tracked (limited by the 64 byte header page)
+#define WEAR_MAX_PAGES (15)
+
+// Pages per copy of the counters: one header page holding the tracked
+// pages and their base counts, the rest hold 32 tally records each. The
+// counters are rewritten (costing one erase of this many pages) each time
+// the tallies fill. Two copies are kept.
+#ifndef WEAR_BANK_PAGES
+#define WEAR_BANK_PAGES (4)
+#endif
+
+// Erase endurance of a flash page (LPC8xx datasheet minimum)
+#ifndef WEAR_ENDURANCE
+#define WEAR_ENDURANCE (10000)
+#endif
+
+// Recent erase rate is measured over the current and previous window
+#ifndef WEAR_RATE_WINDOW_MS
+#define WEAR_RATE_WINDOW_MS (3600000)
+#endif
+
+// Returned in hours_left when there have been no recent erases
+#define WEAR_NO_LIMIT (0xFFFFFFFF)
+
+struct wear_summary {
+	uint32_t pages;			// pages tracked
+	uint32_t total;			// erases of all tracked pages
+	uint32_t worst_page;	// address of most worn page
+	uint32_t worst_count;	// erases of most worn page
+	uint32_t rate;			// recent erases per hour of the page that will reach the limit first
+	uint32_t hours_left;	// until a page reaches WEAR_ENDURANCE at recent rates
+};
+
+struct wear_stats {
+	uint32_t untracked;		// erases of pages that didn't fit in the table
+	uint32_t compactions;	// rewrites of the counters
+};
+
+extern struct wear_stats wear_stats;
+
+int32_t wear_mount(void);
+void wear_erased(uint32_t page_start, uint32_t page_end);
+void wear_summarize(struct wear_summary *s);
+uint32_t wear_count(const void *flash_addr);
+
+#endif /* WEAR_H_ */